@@ -0,0 +1,204 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "hst/refinement.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "hst/environment.h"
+#include "hst/event.h"
+#include "hst/process.h"
+#include "hst/semantic-models.h"
+#include "hst/subset-table.h"
+
+namespace hst {
+
+namespace {
+
+// An Impl state, paired with the τ-closed set of Spec states that Spec could
+// be in after the same trace.  We also remember the pair and event that we
+// first reached it from, so that we can construct counterexamples.
+struct AntichainPair {
+    const Process* impl;
+    SubsetTable::ID spec;
+    std::size_t parent;
+    Event event;
+};
+
+// For each Impl state, the minimal sets of Spec states that we've reached it
+// with.  None of the sets for a particular Impl state is a subset of any other.
+class Antichains {
+  public:
+    explicit Antichains(const SubsetTable* subsets) : subsets_(subsets) {}
+
+    // Adds `spec` to the antichain for `impl`, unless it's a superset of one of
+    // the sets already there.  Any sets that are supersets of `spec` are
+    // removed.  Returns whether we added `spec`.
+    bool insert(const Process& impl, SubsetTable::ID spec)
+    {
+        std::vector<SubsetTable::ID>& antichain = antichains_[impl.index()];
+        for (SubsetTable::ID existing : antichain) {
+            if (is_subset(existing, spec)) {
+                return false;
+            }
+        }
+        auto redundant = [this, spec](SubsetTable::ID existing) {
+            return is_subset(spec, existing);
+        };
+        antichain.erase(
+                std::remove_if(antichain.begin(), antichain.end(), redundant),
+                antichain.end());
+        antichain.push_back(spec);
+        return true;
+    }
+
+    // Returns whether `spec` is still in the antichain for `impl`.  It won't be
+    // if we've since reached `impl` with a smaller set.
+    bool contains(const Process& impl, SubsetTable::ID spec) const
+    {
+        auto it = antichains_.find(impl.index());
+        return it != antichains_.end() &&
+               std::find(it->second.begin(), it->second.end(), spec) !=
+                       it->second.end();
+    }
+
+  private:
+    bool is_subset(SubsetTable::ID lhs, SubsetTable::ID rhs) const
+    {
+        // Interned sets are sorted, so we can compare them with a single merge.
+        SubsetTable::Members small = subsets_->members(lhs);
+        SubsetTable::Members large = subsets_->members(rhs);
+        return small.size() <= large.size() &&
+               std::includes(large.begin(), large.end(), small.begin(),
+                             small.end());
+    }
+
+    const SubsetTable* subsets_;
+    std::unordered_map<Process::Index, std::vector<SubsetTable::ID>>
+            antichains_;
+};
+
+// Returns the interned τ-closure of `processes`.
+SubsetTable::ID
+close(Environment* env, const std::vector<const Process*>& processes)
+{
+    std::vector<Process::Index> indices;
+    for (const Process* process : processes) {
+        for (const Process* member : env->tau_closure(*process)) {
+            indices.push_back(member->index());
+        }
+    }
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    return env->subsets().intern(indices);
+}
+
+// Finds the τ-closed set of Spec states that you can reach from `spec` by
+// following `initial`.  Returns false if none of them can perform `initial`.
+bool
+spec_after(Environment* env, SubsetTable::ID spec, Event initial,
+           SubsetTable::ID* out)
+{
+    std::vector<const Process*> afters;
+    for (Process::Index index : env->subsets().members(spec)) {
+        env->process(index)->transitions(
+                initial, [&afters](const Process& process) {
+                    afters.push_back(&process);
+                });
+    }
+    if (afters.empty()) {
+        return false;
+    }
+    *out = close(env, afters);
+    return true;
+}
+
+// Fills in `counterexample` with the path through the refinement check that
+// leads to the failing pair `id`.
+void
+build_counterexample(Environment* env, const std::vector<AntichainPair>& pairs,
+                     std::size_t id, Event failed_event,
+                     RefinementCounterexample* counterexample)
+{
+    const AntichainPair& failed = pairs[id];
+    std::vector<Event> events;
+    while (id != 0) {
+        const AntichainPair& pair = pairs[id];
+        if (pair.event != Event::tau()) {
+            events.push_back(pair.event);
+        }
+        id = pair.parent;
+    }
+    std::reverse(events.begin(), events.end());
+
+    Process::Set spec;
+    for (Process::Index index : env->subsets().members(failed.spec)) {
+        spec.insert(env->process(index));
+    }
+    counterexample->trace = Trace(std::move(events));
+    counterexample->spec = env->prenormalize(std::move(spec));
+    counterexample->impl = failed.impl;
+    counterexample->event = failed_event;
+}
+
+}  // namespace
+
+bool
+AntichainRefinementChecker::refines(
+        const Process* spec, const Process* impl,
+        RefinementCounterexample* counterexample) const
+{
+    // We explore the pairs breadth-first.  `pairs` is every pair that we've
+    // added to an antichain, in the order that we added them, so it doubles as
+    // our queue.
+    Environment* env = spec->environment();
+    Antichains antichains(&env->subsets());
+    std::vector<AntichainPair> pairs;
+    SubsetTable::ID root = close(env, std::vector<const Process*>{spec});
+    antichains.insert(*impl, root);
+    pairs.push_back(AntichainPair{impl, root, 0, Event::none()});
+
+    Event::Set initials;
+    for (std::size_t id = 0; id < pairs.size(); ++id) {
+        // Copy the pair, since adding its successors can reallocate `pairs`.
+        AntichainPair pair = pairs[id];
+        if (!antichains.contains(*pair.impl, pair.spec)) {
+            // A smaller Spec set has made this pair redundant since we queued
+            // it.
+            continue;
+        }
+
+        initials.clear();
+        pair.impl->cached_initials(&initials);
+        for (Event initial : initials) {
+            // Impl's τ steps don't change the set of Spec states, since it's
+            // already τ-closed.
+            SubsetTable::ID spec_set = pair.spec;
+            if (initial != Event::tau() &&
+                !spec_after(env, pair.spec, initial, &spec_set)) {
+                if (counterexample) {
+                    build_counterexample(env, pairs, id, initial,
+                                         counterexample);
+                }
+                return false;
+            }
+            pair.impl->transitions(initial, [id, initial, spec_set, &antichains,
+                                             &pairs](const Process& after) {
+                if (antichains.insert(after, spec_set)) {
+                    pairs.push_back(
+                            AntichainPair{&after, spec_set, id, initial});
+                }
+            });
+        }
+    }
+    return true;
+}
+
+}  // namespace hst
@@ -0,0 +1,75 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef HST_ARENA_H
+#define HST_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace hst {
+
+class ArenaBase {
+  public:
+    virtual ~ArenaBase() = default;
+};
+
+// Allocates objects of type T out of fixed-size slabs.  There's no way to free
+// an individual object; they're all destroyed, in allocation order, when the
+// arena itself is destroyed.
+template <typename T>
+class Arena : public ArenaBase {
+  public:
+    Arena() = default;
+    Arena(const Arena& other) = delete;
+    Arena& operator=(const Arena& other) = delete;
+    ~Arena() override;
+
+    template <typename... Args>
+    T* create(Args&&... args);
+
+  private:
+    static const std::size_t slab_size = 64;
+    using Storage =
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+    std::vector<std::unique_ptr<Storage[]>> slabs_;
+    // The number of objects that we've created in the last slab.
+    std::size_t used_ = slab_size;
+};
+
+template <typename T>
+Arena<T>::~Arena()
+{
+    for (std::size_t i = 0; i < slabs_.size(); i++) {
+        std::size_t count = (i == slabs_.size() - 1) ? used_ : slab_size;
+        for (std::size_t j = 0; j < count; j++) {
+            reinterpret_cast<T*>(&slabs_[i][j])->~T();
+        }
+    }
+}
+
+template <typename T>
+template <typename... Args>
+T*
+Arena<T>::create(Args&&... args)
+{
+    if (used_ == slab_size) {
+        slabs_.emplace_back(new Storage[slab_size]);
+        used_ = 0;
+    }
+    void* storage = &slabs_.back()[used_];
+    T* result = new (storage) T(std::forward<Args>(args)...);
+    used_++;
+    return result;
+}
+
+}  // namespace hst
+#endif  // HST_ARENA_H
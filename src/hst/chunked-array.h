@@ -0,0 +1,105 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef HST_CHUNKED_ARRAY_H
+#define HST_CHUNKED_ARRAY_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace hst {
+
+// An array with up to 2^32 elements that never moves an element once it's been
+// created.  The elements live in a directory of chunks that double in size,
+// which we allocate the first time that someone touches an element in them.
+// That means you can read from the array without holding any locks, even while
+// other threads are adding elements to it.  (You're still responsible for
+// making sure that the thread reading an element can see the write that filled
+// it in.)
+template <typename T>
+class ChunkedArray {
+  public:
+    ChunkedArray();
+    ChunkedArray(const ChunkedArray& other) = delete;
+    ChunkedArray& operator=(const ChunkedArray& other) = delete;
+    ~ChunkedArray();
+
+    // Returns the element at `index`, which must be in a chunk that someone has
+    // already allocated via `slot`.
+    const T& operator[](std::uint32_t index) const
+    {
+        std::size_t chunk, offset;
+        locate(index, &chunk, &offset);
+        return chunks_[chunk].load(std::memory_order_acquire)[offset];
+    }
+
+    // Returns a mutable reference to the element at `index`, allocating its
+    // chunk if necessary.
+    T& slot(std::uint32_t index);
+
+  private:
+    static const std::size_t first_chunk_bits = 10;
+    static const std::size_t chunk_count = 32 - first_chunk_bits + 1;
+
+    static void
+    locate(std::uint32_t index, std::size_t* chunk, std::size_t* offset)
+    {
+        // Chunk 0 holds the first 2^first_chunk_bits elements; each chunk after
+        // that is as large as all of the chunks before it combined.
+        std::uint32_t shifted = index >> first_chunk_bits;
+        std::size_t c = 0;
+        while (shifted >> c) {
+            c++;
+        }
+        *chunk = c;
+        *offset = c == 0 ? index
+                         : index - (std::size_t(1) << (first_chunk_bits + c - 1));
+    }
+
+    std::atomic<T*> chunks_[chunk_count];
+    std::mutex mutex_;
+};
+
+template <typename T>
+ChunkedArray<T>::ChunkedArray()
+{
+    for (std::size_t i = 0; i < chunk_count; i++) {
+        chunks_[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+ChunkedArray<T>::~ChunkedArray()
+{
+    for (std::size_t i = 0; i < chunk_count; i++) {
+        delete[] chunks_[i].load(std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+T&
+ChunkedArray<T>::slot(std::uint32_t index)
+{
+    std::size_t chunk, offset;
+    locate(index, &chunk, &offset);
+    T* elements = chunks_[chunk].load(std::memory_order_acquire);
+    if (elements == nullptr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        elements = chunks_[chunk].load(std::memory_order_relaxed);
+        if (elements == nullptr) {
+            std::size_t bits = first_chunk_bits + (chunk == 0 ? 0 : chunk - 1);
+            elements = new T[std::size_t(1) << bits]();
+            chunks_[chunk].store(elements, std::memory_order_release);
+        }
+    }
+    return elements[offset];
+}
+
+}  // namespace hst
+#endif  // HST_CHUNKED_ARRAY_H
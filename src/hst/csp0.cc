@@ -8,6 +8,7 @@
 #include "hst/csp0.h"
 
 #include <cassert>
+#include <cstddef>
 #include <cstring>
 #include <functional>
 #include <string>
@@ -382,14 +383,15 @@ class SkipIDChar : public SkipWhile<SkipIDChar> {
 };
 
 // Tries to parse a "dollar identifier" (one that starts with a dollar sign).
-// If we succeed, we place the name of the identifier into `out`.  These are
+// If we succeed, we place the location of the identifier in the input text
+// into `name` and `length`.  These are
 // used when generating a CSP₀ script programmatically; higher level languages
 // won't provide these as identifiers that the user can use, and so these are
 // available for the generator script to use without having to worry about
 // conflicting with user identifiers.
 class DollarIdentifier : public Parser {
   public:
-    DollarIdentifier(Parser* parent, std::string* out)
+    DollarIdentifier(Parser* parent, const char** name, std::size_t* length)
         : Parser(parent, "dollar identifier")
     {
         const char* start = p_;
@@ -399,7 +401,8 @@ class DollarIdentifier : public Parser {
         return_if_error(attempt<RequireIDChar>());
         // Parse any additional characters in the identifier
         attempt<SkipIDChar>();
-        *out = std::string(start, p_ - start);
+        *name = start;
+        *length = p_ - start;
     }
 };
 
@@ -421,10 +424,11 @@ class RequireIDStart : public RequireChar<RequireIDStart> {
 };
 
 // Tries to parse a regular identifier (one that doesn't start with a dollar
-// sign).  If we succeed, we place the name of the identifier into `out`.
+// sign).  If we succeed, we place the location of the identifier in the input
+// text into `name` and `length`.
 class RegularIdentifier : public Parser {
   public:
-    RegularIdentifier(Parser* parent, std::string* out)
+    RegularIdentifier(Parser* parent, const char** name, std::size_t* length)
         : Parser(parent, "regular identifier")
     {
         const char* start = p_;
@@ -432,7 +436,8 @@ class RegularIdentifier : public Parser {
         return_if_error(attempt<RequireIDStart>());
         // Parse any additional characters in the identifier
         attempt<SkipIDChar>();
-        *out = std::string(start, p_ - start);
+        *name = start;
+        *length = p_ - start;
     }
 };
 
@@ -442,8 +447,19 @@ class Identifier : public Parser {
   public:
     Identifier(Parser* parent, std::string* out) : Parser(parent, "identifier")
     {
-        return_if_success(attempt<RegularIdentifier>(out));
-        return_if_success(attempt<DollarIdentifier>(out));
+        const char* name;
+        std::size_t length;
+        return_if_error(attempt<Identifier>(&name, &length));
+        *out = std::string(name, length);
+    }
+
+    // Same as above, but places the location of the identifier in the input
+    // text into `name` and `length`, instead of copying it into a string.
+    Identifier(Parser* parent, const char** name, std::size_t* length)
+        : Parser(parent, "identifier")
+    {
+        return_if_success(attempt<RegularIdentifier>(name, length));
+        return_if_success(attempt<DollarIdentifier>(name, length));
         fail();
     }
 };
@@ -605,14 +621,17 @@ class Process2 : public Parser {
         // process2 = process1 | identifier | event → process2
         return_if_success(attempt<Process1>(env, scope, out));
 
-        std::string id;
-        return_if_error(attempt<Identifier>(&id));
+        // We don't copy the identifier out of the input text unless we need
+        // to, since it's usually an event name, which we can look up in place.
+        const char* id;
+        std::size_t id_length;
+        return_if_error(attempt<Identifier>(&id, &id_length));
 
         // identifier@scope
         if (attempt<RequireString>("@")) {
             hst::RecursionScope::ID scope = 0;
             return_if_error(attempt<Integer<hst::RecursionScope::ID>>(&scope));
-            *out = env->recursive_process(scope, std::move(id));
+            *out = env->recursive_process(scope, std::string(id, id_length));
             return;
         }
 
@@ -620,7 +639,7 @@ class Process2 : public Parser {
 
         // prefix
         if (attempt<RequireString>("->") || attempt<RequireString>("→")) {
-            hst::Event initial(id);
+            hst::Event initial(id, id_length);
             const hst::Process* after;
             return_if_error(attempt<SkipWhitespace>());
             return_if_error(attempt<Process2>(env, scope, &after));
@@ -635,7 +654,7 @@ class Process2 : public Parser {
             return;
         }
 
-        *out = scope->add(std::move(id));
+        *out = scope->add(std::string(id, id_length));
         return;
     }
 };
@@ -845,6 +864,34 @@ class Process12 : public Parser {
     }
 };
 
+// The rest of a normalize[model] process, after the model.
+template <typename Model>
+class Normalize : public Parser {
+  public:
+    Normalize(Parser* parent, hst::Environment* env,
+              hst::RecursionScope* scope, const hst::Process** out)
+        : Parser(parent, "normalize")
+    {
+        hst::Process::Set processes;
+        return_if_error(attempt<SkipWhitespace>());
+        return_if_error(attempt<ProcessSet>(env, scope, &processes));
+        attempt<SkipWhitespace>();
+        if (attempt<RequireString>("within")) {
+            hst::Process::Set root;
+            return_if_error(attempt<SkipWhitespace>());
+            return_if_error(attempt<ProcessSet>(env, scope, &root));
+            const hst::NormalizedProcess* prenormalized_root =
+                    env->prenormalize(std::move(root));
+            *out = env->normalize<Model>(prenormalized_root,
+                                         std::move(processes));
+        } else {
+            const hst::NormalizedProcess* prenormalized_root =
+                    env->prenormalize(std::move(processes));
+            *out = env->normalize<Model>(prenormalized_root);
+        }
+    }
+};
+
 class Process13 : public Parser {
   public:
     Process13(Parser* parent, hst::Environment* env, hst::RecursionScope* scope,
@@ -865,23 +912,17 @@ class Process13 : public Parser {
 
         // normalize[model] {process} within {process}
         if (attempt<RequireString>("normalize[T]")) {
-            hst::Process::Set processes;
-            return_if_error(attempt<SkipWhitespace>());
-            return_if_error(attempt<ProcessSet>(env, scope, &processes));
-            attempt<SkipWhitespace>();
-            if (attempt<RequireString>("within")) {
-                hst::Process::Set root;
-                return_if_error(attempt<SkipWhitespace>());
-                return_if_error(attempt<ProcessSet>(env, scope, &root));
-                const hst::NormalizedProcess* prenormalized_root =
-                        env->prenormalize(std::move(root));
-                *out = env->normalize<hst::Traces>(prenormalized_root,
-                                                   std::move(processes));
-            } else {
-                const hst::NormalizedProcess* prenormalized_root =
-                        env->prenormalize(std::move(processes));
-                *out = env->normalize<hst::Traces>(prenormalized_root);
-            }
+            return_if_error(attempt<Normalize<hst::Traces>>(env, scope, out));
+            return;
+        }
+        if (attempt<RequireString>("normalize[F]")) {
+            return_if_error(
+                    attempt<Normalize<hst::Failures>>(env, scope, out));
+            return;
+        }
+        if (attempt<RequireString>("normalize[FD]")) {
+            return_if_error(attempt<Normalize<hst::FailuresDivergences>>(
+                    env, scope, out));
             return;
         }
 
@@ -7,8 +7,10 @@
 
 #include "hst/environment.h"
 
-#include <functional>
+#include <utility>
+#include <vector>
 
+#include "hst/function-ref.h"
 #include "hst/hash.h"
 
 namespace hst {
@@ -19,12 +21,12 @@ class Omega : public Process {
   public:
     Omega() = default;
 
-    void initials(std::function<void(Event)> op) const override;
+    void initials(function_ref<void(Event)> op) const override;
     void afters(Event initial,
-                std::function<void(const Process&)> op) const override;
-    void subprocesses(std::function<void(const Process&)> op) const override;
+                function_ref<void(const Process&)> op) const override;
+    void subprocesses(function_ref<void(const Process&)> op) const override;
 
-    std::size_t hash() const override;
+    std::size_t compute_hash() const override;
     bool operator==(const Process& other) const override;
     unsigned int precedence() const override { return 1; }
     void print(std::ostream& out) const override;
@@ -33,22 +35,22 @@ class Omega : public Process {
 }  // namespace
 
 void
-Omega::initials(std::function<void(Event)> op) const
+Omega::initials(function_ref<void(Event)> op) const
 {
 }
 
 void
-Omega::afters(Event initial, std::function<void(const Process&)> op) const
+Omega::afters(Event initial, function_ref<void(const Process&)> op) const
 {
 }
 
 void
-Omega::subprocesses(std::function<void(const Process&)> op) const
+Omega::subprocesses(function_ref<void(const Process&)> op) const
 {
 }
 
 std::size_t
-Omega::hash() const
+Omega::compute_hash() const
 {
     static hash_scope omega;
     return hasher(omega).value();
@@ -75,12 +77,12 @@ namespace {
 class Skip : public Process {
   public:
     explicit Skip(const Process* omega) : omega_(omega) {}
-    void initials(std::function<void(Event)> op) const override;
+    void initials(function_ref<void(Event)> op) const override;
     void afters(Event initial,
-                std::function<void(const Process&)> op) const override;
-    void subprocesses(std::function<void(const Process&)> op) const override;
+                function_ref<void(const Process&)> op) const override;
+    void subprocesses(function_ref<void(const Process&)> op) const override;
 
-    std::size_t hash() const override;
+    std::size_t compute_hash() const override;
     bool operator==(const Process& other) const override;
     unsigned int precedence() const override { return 1; }
     void print(std::ostream& out) const override;
@@ -92,13 +94,13 @@ class Skip : public Process {
 }  // namespace
 
 void
-Skip::initials(std::function<void(Event)> op) const
+Skip::initials(function_ref<void(Event)> op) const
 {
     op(Event::tick());
 }
 
 void
-Skip::afters(Event initial, std::function<void(const Process&)> op) const
+Skip::afters(Event initial, function_ref<void(const Process&)> op) const
 {
     if (initial == Event::tick()) {
         op(*omega_);
@@ -106,12 +108,12 @@ Skip::afters(Event initial, std::function<void(const Process&)> op) const
 }
 
 void
-Skip::subprocesses(std::function<void(const Process&)> op) const
+Skip::subprocesses(function_ref<void(const Process&)> op) const
 {
 }
 
 std::size_t
-Skip::hash() const
+Skip::compute_hash() const
 {
     static hash_scope skip;
     return hasher(skip).value();
@@ -139,12 +141,12 @@ class Stop : public Process {
   public:
     Stop() = default;
 
-    void initials(std::function<void(Event)> op) const override;
+    void initials(function_ref<void(Event)> op) const override;
     void afters(Event initial,
-                std::function<void(const Process&)> op) const override;
-    void subprocesses(std::function<void(const Process&)> op) const override;
+                function_ref<void(const Process&)> op) const override;
+    void subprocesses(function_ref<void(const Process&)> op) const override;
 
-    std::size_t hash() const override;
+    std::size_t compute_hash() const override;
     bool operator==(const Process& other) const override;
     unsigned int precedence() const override { return 1; }
     void print(std::ostream& out) const override;
@@ -153,22 +155,22 @@ class Stop : public Process {
 }  // namespace
 
 void
-Stop::initials(std::function<void(Event)> op) const
+Stop::initials(function_ref<void(Event)> op) const
 {
 }
 
 void
-Stop::afters(Event initial, std::function<void(const Process&)> op) const
+Stop::afters(Event initial, function_ref<void(const Process&)> op) const
 {
 }
 
 void
-Stop::subprocesses(std::function<void(const Process&)> op) const
+Stop::subprocesses(function_ref<void(const Process&)> op) const
 {
 }
 
 std::size_t
-Stop::hash() const
+Stop::compute_hash() const
 {
     static hash_scope stop;
     return hasher(stop).value();
@@ -191,10 +193,69 @@ Stop::print(std::ostream& out) const
 }
 
 Environment::Environment()
+    : shards_(new Shard[shard_count]), next_process_index_(0)
 {
-    omega_ = register_process(new Omega);
-    skip_ = register_process(new Skip(omega_));
-    stop_ = register_process(new Stop);
+    omega_ = register_process<Omega>();
+    skip_ = register_process<Skip>(omega_);
+    stop_ = register_process<Stop>();
+}
+
+void
+Environment::cache_transitions()
+{
+    if (!transition_cache_) {
+        transition_cache_.reset(new TransitionCache(this));
+    }
+}
+
+Environment::Registry::Registry() : entries_(64, Entry{0, nullptr}) {}
+
+Process*
+Environment::Registry::find(std::size_t hash, const Process& candidate) const
+{
+    std::size_t mask = entries_.size() - 1;
+    for (std::size_t i = hash & mask;; i = (i + 1) & mask) {
+        const Entry& entry = entries_[i];
+        if (entry.process == nullptr) {
+            return nullptr;
+        }
+        if (entry.hash == hash && *entry.process == candidate) {
+            return entry.process;
+        }
+    }
+}
+
+void
+Environment::Registry::insert(std::size_t hash, Process* process)
+{
+    // Keep the table at most half full, so that probe sequences stay short.
+    if ((size_ + 1) * 2 > entries_.size()) {
+        grow();
+    }
+    std::size_t mask = entries_.size() - 1;
+    std::size_t i = hash & mask;
+    while (entries_[i].process != nullptr) {
+        i = (i + 1) & mask;
+    }
+    entries_[i] = Entry{hash, process};
+    size_++;
+}
+
+void
+Environment::Registry::grow()
+{
+    std::vector<Entry> old_entries(entries_.size() * 2, Entry{0, nullptr});
+    std::swap(entries_, old_entries);
+    std::size_t mask = entries_.size() - 1;
+    for (const Entry& entry : old_entries) {
+        if (entry.process != nullptr) {
+            std::size_t i = entry.hash & mask;
+            while (entries_[i].process != nullptr) {
+                i = (i + 1) & mask;
+            }
+            entries_[i] = entry;
+        }
+    }
 }
 
 }  // namespace hst
@@ -8,11 +8,25 @@
 #ifndef HST_ENVIRONMENT_H
 #define HST_ENVIRONMENT_H
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "hst/arena.h"
+#include "hst/chunked-array.h"
 #include "hst/event.h"
 #include "hst/process.h"
 #include "hst/recursion.h"
+#include "hst/subset-table.h"
+#include "hst/tau-closure-cache.h"
+#include "hst/transition-cache.h"
 
 namespace hst {
 
@@ -35,6 +49,54 @@ class Environment {
     const NormalizedProcess* prenormalize(const Process* p);
     template <typename Model>
     const NormalizedProcess* normalize(const NormalizedProcess* root);
+    // Same as above, but uses `threads` worker threads to calculate the
+    // bisimulation.  The result is identical to the single-threaded version.
+    template <typename Model>
+    const NormalizedProcess*
+    normalize(const NormalizedProcess* root, unsigned int threads);
+
+    // Returns the process with the given index.  This is safe to call from
+    // any thread, as long as the process has been registered.
+    const Process* process(Process::Index index) const
+    {
+        return processes_[index];
+    }
+
+    // Turns on the explicit LTS cache for this environment.  After this, the
+    // first time that you ask for a process's transitions (via
+    // Process::transitions), we record them in a compact table; any later
+    // requests read them back from that table instead of recalculating them
+    // from the process's operational semantics.  This uses more memory, but
+    // can be much faster when you revisit the same processes many times, such
+    // as during a refinement check.
+    void cache_transitions();
+
+    // Returns the transition cache, or nullptr if it hasn't been enabled.
+    TransitionCache* transition_cache() const
+    {
+        return transition_cache_.get();
+    }
+
+    // Returns the τ-closure of `process`.  We remember the closure of every
+    // process that you ask about, so this is only expensive the first time you
+    // ask about any particular process.
+    const Process::Set& tau_closure(const Process& process)
+    {
+        return tau_closures_.closure(process);
+    }
+
+    // Returns whether `process` can diverge (that is, perform an infinite
+    // sequence of τ events).  This is calculated by the same search of the
+    // τ-graph that the τ-closure uses, but doesn't need to build any closures,
+    // so it's linear in the size of that graph.
+    bool diverges(const Process& process)
+    {
+        return tau_closures_.diverges(process);
+    }
+
+    // The interned sets of processes that prenormalized processes are built
+    // from.
+    SubsetTable& subsets() { return subsets_; }
 
     // These will typically only be used internally or in test cases.
     RecursiveProcess*
@@ -47,52 +109,127 @@ class Environment {
     const NormalizedProcess*
     normalize(const NormalizedProcess* root, Process::Set processes);
 
-    // Ensures that there is exactly one process in the registry equal to
-    // `process`, returning a pointer to that process.
-    template <typename T>
-    T* register_process(T* process);
+    // Ensures that there is exactly one process in the registry equal to the
+    // T that `args` would construct, returning a pointer to that process.  We
+    // build the candidate on the stack and use it as the lookup key; we only
+    // allocate space for a new process (in the arena for T) if there isn't
+    // already an equal process in the registry.
+    //
+    // This is safe to call from multiple threads at once; if two threads
+    // register equal processes, they'll both get back the same pointer.
+    template <typename T, typename... Args>
+    T* register_process(Args&&... args);
 
   private:
-    struct deref_hash {
-        std::size_t operator()(const std::unique_ptr<Process>& ptr) const
-        {
-            return ptr->hash();
-        }
+    // A hash-consing table of every process in the environment.  This is an
+    // open-addressing table, which only holds pointers; the processes
+    // themselves are owned by the per-type arenas.
+    class Registry {
+      public:
+        Registry();
+
+        // Returns the process in the registry that's equal to `candidate`, or
+        // nullptr if there isn't one.
+        Process* find(std::size_t hash, const Process& candidate) const;
+
+        // Adds `process` to the registry.  There must not already be an equal
+        // process in the registry.
+        void insert(std::size_t hash, Process* process);
+
+      private:
+        struct Entry {
+            std::size_t hash;
+            Process* process;
+        };
+
+        void grow();
+
+        std::vector<Entry> entries_;
+        std::size_t size_ = 0;
     };
 
-    struct deref_key_equal {
-        bool operator()(const std::unique_ptr<Process>& lhs,
-                        const std::unique_ptr<Process>& rhs) const
-        {
-            return *lhs == *rhs;
-        }
+    // The registry is split into shards, each with its own lock, table, and
+    // arenas, so that threads registering unrelated processes don't contend
+    // with each other.  We use the hash of each process to choose its shard.
+    class Shard {
+      public:
+        template <typename T>
+        Arena<T>* arena();
+
+        std::mutex mutex;
+        Registry registry;
+
+      private:
+        std::unordered_map<std::type_index, std::unique_ptr<ArenaBase>>
+                arenas_;
     };
 
-    using Registry = std::unordered_set<std::unique_ptr<Process>, deref_hash,
-                                        deref_key_equal>;
+    static const std::size_t shard_bits = 6;
+    static const std::size_t shard_count = std::size_t(1) << shard_bits;
 
-    Registry registry_;
+    Shard& shard(std::size_t hash)
+    {
+        // The registry uses the low bits of the hash to find a process within
+        // a shard, so we use (a scrambled copy of) the high bits to choose the
+        // shard.
+        std::uint64_t scrambled = hash * UINT64_C(0x9e3779b97f4a7c15);
+        return shards_[scrambled >> (64 - shard_bits)];
+    }
+
+    std::unique_ptr<Shard[]> shards_;
+    // Maps each process index to its process.
+    ChunkedArray<const Process*> processes_;
+    std::atomic<Process::Index> next_process_index_;
+    std::unique_ptr<TransitionCache> transition_cache_;
+    TauClosureCache tau_closures_;
+    SubsetTable subsets_;
     const Process* omega_;
     const Process* skip_;
     const Process* stop_;
-    Process::Index next_process_index_ = 0;
     RecursionScope::ID next_recursion_scope_ = 0;
 };
 
 template <typename T>
+Arena<T>*
+Environment::Shard::arena()
+{
+    std::unique_ptr<ArenaBase>& arena = arenas_[std::type_index(typeid(T))];
+    if (!arena) {
+        arena.reset(new Arena<T>);
+    }
+    return static_cast<Arena<T>*>(arena.get());
+}
+
+template <typename T, typename... Args>
 T*
-Environment::register_process(T* process)
+Environment::register_process(Args&&... args)
 {
-    std::unique_ptr<T> owned(process);
-    auto result = registry_.insert(std::move(owned));
-    if (result.second) {
-        // We just added `process`, so assign it an index.
-        process->index_ = next_process_index_++;
+    T candidate(std::forward<Args>(args)...);
+    std::size_t hash = candidate.compute_hash();
+    candidate.hash_ = hash;
+    // Note that we construct the candidate before grabbing the lock, since
+    // constructing some processes will register other processes.
+    Shard& shard = this->shard(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Process* existing = shard.registry.find(hash, candidate);
+    if (existing) {
+        // This static_cast is safe since we've already verified that the
+        // existing process is equal to `candidate`, and operator== will only
+        // return true for two processes of the same type.
+        return static_cast<T*>(existing);
     }
-    // This static_cast is safe, even if we're returning an existing process
-    // from the registry, since we've already verified that whatever we return
-    // is equal to `process`.
-    return static_cast<T*>(result.first->get());
+
+    // This is a new process, so move it into permanent storage and assign it an
+    // index.
+    // We publish the process in the index table before adding it to the
+    // registry, so that any thread that can find the process can also look it
+    // up by index.
+    T* process = shard.arena<T>()->create(std::move(candidate));
+    process->environment_ = this;
+    process->index_ = next_process_index_.fetch_add(1);
+    processes_.slot(process->index_) = process;
+    shard.registry.insert(hash, process);
+    return process;
 }
 
 }  // namespace hst
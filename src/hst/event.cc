@@ -8,53 +8,133 @@
 #include "hst/event.h"
 
 #include <algorithm>
-#include <map>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <mutex>
 #include <ostream>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include "hst/chunked-array.h"
 #include "hst/hash.h"
 
 namespace hst {
 
-using std::map;
 using std::string;
 
+// The table of event names is shared by all threads.  Looking up the name of
+// an event is just an array access, which doesn't need a lock, since names
+// never move once they're in the table.  Interning a name uses an
+// open-addressing hash table keyed by the contents of the name, and holds
+// `mutex_` while it does so.
 class Event::Table {
   public:
-    Table() = default;
+    Table();
 
-    map<Event::Index, const string*> names;
-    map<const string, Event::Index> indices;
-    Event::Index next_index = 1;
+    Event::Index find_or_create(const char* name, std::size_t length);
+    const string& name(Event::Index index) const { return names_[index]; }
+
+  private:
+    struct Slot {
+        std::size_t hash;
+        Event::Index index;  // 0 if the slot is empty
+    };
+
+    static std::size_t hash(const char* name, std::size_t length);
+    void grow();
+
+    std::mutex mutex_;
+    ChunkedArray<string> names_;
+    std::vector<Slot> slots_;
+    Event::Index next_index_ = 1;
 };
 
-std::unique_ptr<Event::Table> Event::table_;
+Event::Table::Table() : slots_(64, Slot{0, 0})
+{
+    // Index 0 is Event::none().
+    names_.slot(0);
+    find_or_create("τ", sizeof("τ") - 1);
+    find_or_create("✔", sizeof("✔") - 1);
+}
+
+std::size_t
+Event::Table::hash(const char* name, std::size_t length)
+{
+    // FNV-1a
+    std::uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for (std::size_t i = 0; i < length; i++) {
+        hash ^= static_cast<unsigned char>(name[i]);
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return static_cast<std::size_t>(hash);
+}
 
 Event::Index
-Event::find_or_create_event(const string& name)
+Event::Table::find_or_create(const char* name, std::size_t length)
 {
-    if (!table_) {
-        table_ = std::unique_ptr<Event::Table>(new Event::Table);
+    std::size_t hash = Table::hash(name, length);
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t mask = slots_.size() - 1;
+    std::size_t i = hash & mask;
+    for (; slots_[i].index != 0; i = (i + 1) & mask) {
+        if (slots_[i].hash == hash) {
+            const string& existing = names_[slots_[i].index];
+            if (existing.size() == length &&
+                std::equal(name, name + length, existing.begin())) {
+                return slots_[i].index;
+            }
+        }
     }
 
-    Index& index = table_->indices[name];
-    if (index == 0) {
-        // This is a new name.  Create an event index for it and stash that
-        // away.
-        index = table_->next_index++;
+    // This is a new name.  Copy it into the name table, and record its index
+    // in the hash table.
+    Event::Index index = next_index_++;
+    names_.slot(index).assign(name, length);
+    slots_[i] = Slot{hash, index};
+    // Keep the table at most half full, so that probe sequences stay short.
+    if ((index + 1) * 2 > slots_.size()) {
+        grow();
+    }
+    return index;
+}
 
-        // Find the copy of the name inside of the table so that we can stash
-        // that in the reverse table.
-        const string& saved_name = table_->indices.find(name)->first;
-        table_->names[index] = &saved_name;
+void
+Event::Table::grow()
+{
+    std::vector<Slot> old_slots(slots_.size() * 2, Slot{0, 0});
+    std::swap(slots_, old_slots);
+    std::size_t mask = slots_.size() - 1;
+    for (const Slot& slot : old_slots) {
+        if (slot.index != 0) {
+            std::size_t i = slot.hash & mask;
+            while (slots_[i].index != 0) {
+                i = (i + 1) & mask;
+            }
+            slots_[i] = slot;
+        }
     }
+}
 
-    return index;
+Event::Table&
+Event::table()
+{
+    // Function-local statics are initialized exactly once, even if several
+    // threads get here at the same time.
+    static Table table;
+    return table;
+}
+
+Event::Index
+Event::find_or_create_event(const char* name, std::size_t length)
+{
+    return table().find_or_create(name, length);
 }
 
 const string& Event::name() const
 {
-    return *table_->names[index_];
+    return table().name(index_);
 }
 
 std::ostream& operator<<(std::ostream& out, const Event& event)
@@ -62,16 +142,320 @@ std::ostream& operator<<(std::ostream& out, const Event& event)
     return out << event.name();
 }
 
+Event::Set::Set(std::initializer_list<Event> events)
+{
+    insert(events.begin(), events.end());
+}
+
+Event::Set::const_iterator
+Event::Set::begin() const
+{
+    return const_iterator(this, 0);
+}
+
+Event::Set::const_iterator
+Event::Set::end() const
+{
+    return const_iterator(this, std::size_t(-1));
+}
+
+namespace {
+
+// Returns the number of zero bits below the lowest set bit of `word`, which
+// must be nonzero.
+unsigned int
+count_trailing_zeros(std::uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    unsigned int count = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+}  // namespace
+
+void
+Event::Set::const_iterator::advance(std::size_t position)
+{
+    static const std::size_t end = std::size_t(-1);
+    if (!set_->dense()) {
+        if (position < set_->size_) {
+            position_ = position;
+            current_ = set_->sorted()[position];
+        } else {
+            position_ = end;
+        }
+        return;
+    }
+
+    const std::vector<Word>& words = set_->words_;
+    std::size_t word_index = position / word_bits;
+    if (word_index >= words.size()) {
+        position_ = end;
+        return;
+    }
+    Word word = words[word_index] & (~Word(0) << (position % word_bits));
+    while (word == 0) {
+        if (++word_index == words.size()) {
+            position_ = end;
+            return;
+        }
+        word = words[word_index];
+    }
+    position_ = word_index * word_bits + count_trailing_zeros(word);
+    current_ = set_->first_word_ * word_bits + position_;
+}
+
+bool
+Event::Set::contains(Event event) const
+{
+    Index index = event.index_;
+    if (dense()) {
+        return (word(index / word_bits) >> (index % word_bits)) & 1;
+    }
+    return std::binary_search(sorted(), sorted() + size_, index);
+}
+
+std::vector<Event::Index>
+Event::Set::indices() const
+{
+    std::vector<Index> result;
+    result.reserve(size_);
+    for (const Event event : *this) {
+        result.push_back(event.index_);
+    }
+    return result;
+}
+
+void
+Event::Set::assign(const std::vector<Index>& indices)
+{
+    words_.clear();
+    sparse_.clear();
+    first_word_ = 0;
+    size_ = indices.size();
+    if (size_ <= small_capacity) {
+        std::copy(indices.begin(), indices.end(), small_);
+        return;
+    }
+
+    std::size_t first_word = indices.front() / word_bits;
+    std::size_t word_count = indices.back() / word_bits - first_word + 1;
+    if (!dense_enough(size_, word_count, 1)) {
+        sparse_ = indices;
+        return;
+    }
+    first_word_ = first_word;
+    words_.assign(word_count, 0);
+    for (Index index : indices) {
+        words_[index / word_bits - first_word] |= Word(1)
+                                                  << (index % word_bits);
+    }
+}
+
+bool
+Event::Set::insert(Event event)
+{
+    Index index = event.index_;
+    if (!dense()) {
+        const Index* begin = sorted();
+        const Index* end = begin + size_;
+        const Index* position = std::lower_bound(begin, end, index);
+        if (position != end && *position == index) {
+            return false;
+        }
+        if (!sparse() && size_ < small_capacity) {
+            Index* small_position = small_ + (position - begin);
+            std::copy_backward(small_position, small_ + size_,
+                               small_ + size_ + 1);
+            *small_position = index;
+            size_++;
+            return true;
+        }
+        if (!sparse()) {
+            // There's no more room inline, so move the set to the heap, using
+            // whichever representation suits it.
+            std::vector<Index> updated(begin, end);
+            updated.insert(updated.begin() + (position - begin), index);
+            assign(updated);
+            return true;
+        }
+        sparse_.insert(sparse_.begin() + (position - begin), index);
+        size_++;
+        std::size_t word_count =
+                sparse_.back() / word_bits - sparse_.front() / word_bits + 1;
+        if (dense_enough(size_, word_count, 1)) {
+            std::vector<Index> updated;
+            updated.swap(sparse_);
+            assign(updated);
+        }
+        return true;
+    }
+
+    std::size_t word_index = index / word_bits;
+    if (word_index < first_word_ ||
+        word_index - first_word_ >= words_.size()) {
+        // The bitset doesn't cover this event yet.  If covering it would make
+        // the bitset too sparse, switch back to a sorted array.
+        std::size_t first_word = std::min(word_index, first_word_);
+        std::size_t last_word =
+                std::max(word_index, first_word_ + words_.size() - 1);
+        if (!dense_enough(size_ + 1, last_word - first_word + 1, 2)) {
+            std::vector<Index> updated = indices();
+            updated.insert(
+                    std::lower_bound(updated.begin(), updated.end(), index),
+                    index);
+            assign(updated);
+            return true;
+        }
+        if (word_index < first_word_) {
+            words_.insert(words_.begin(), first_word_ - word_index, 0);
+            first_word_ = word_index;
+        } else {
+            words_.resize(word_index - first_word_ + 1, 0);
+        }
+    }
+    Word& word = words_[word_index - first_word_];
+    Word mask = Word(1) << (index % word_bits);
+    if (word & mask) {
+        return false;
+    }
+    word |= mask;
+    size_++;
+    return true;
+}
+
+Event::Set::size_type
+Event::Set::erase(Event event)
+{
+    Index index = event.index_;
+    if (dense()) {
+        std::size_t word_index = index / word_bits;
+        Word mask = Word(1) << (index % word_bits);
+        if (!(word(word_index) & mask)) {
+            return 0;
+        }
+        words_[word_index - first_word_] &= ~mask;
+        size_--;
+        return 1;
+    }
+
+    if (sparse()) {
+        auto position = std::lower_bound(sparse_.begin(), sparse_.end(), index);
+        if (position == sparse_.end() || *position != index) {
+            return 0;
+        }
+        sparse_.erase(position);
+        size_--;
+        if (size_ <= small_capacity) {
+            std::copy(sparse_.begin(), sparse_.end(), small_);
+            sparse_.clear();
+        }
+        return 1;
+    }
+
+    Index* end = small_ + size_;
+    Index* position = std::lower_bound(small_, end, index);
+    if (position == end || *position != index) {
+        return 0;
+    }
+    std::copy(position + 1, end, position);
+    size_--;
+    return 1;
+}
+
+void
+Event::Set::clear()
+{
+    words_.clear();
+    sparse_.clear();
+    first_word_ = 0;
+    size_ = 0;
+}
+
+bool
+Event::Set::is_subset_of(const Set& other) const
+{
+    if (size_ > other.size_) {
+        return false;
+    }
+    if (dense() && other.dense()) {
+        for (std::size_t i = 0; i < words_.size(); i++) {
+            if (words_[i] & ~other.word(first_word_ + i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (!dense() && !other.dense()) {
+        return std::includes(other.sorted(), other.sorted() + other.size_,
+                             sorted(), sorted() + size_);
+    }
+    for (const Event event : *this) {
+        if (!other.contains(event)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool
+Event::Set::operator==(const Set& other) const
+{
+    if (size_ != other.size_) {
+        return false;
+    }
+    if (!dense() && !other.dense()) {
+        return std::equal(sorted(), sorted() + size_, other.sorted());
+    }
+    // The sets are the same size, so one is a subset of the other only if
+    // they're equal.
+    return is_subset_of(other);
+}
+
+template <typename F>
+void
+Event::Set::for_each_word(F op) const
+{
+    if (dense()) {
+        for (std::size_t i = 0; i < words_.size(); i++) {
+            if (words_[i] != 0) {
+                op(first_word_ + i, words_[i]);
+            }
+        }
+        return;
+    }
+
+    // The array is sorted, so all of the events that belong to the same word
+    // are next to each other.
+    const Index* indices = sorted();
+    std::size_t i = 0;
+    while (i < size_) {
+        std::size_t word_index = indices[i] / word_bits;
+        Word word = 0;
+        for (; i < size_ && indices[i] / word_bits == word_index; i++) {
+            word |= Word(1) << (indices[i] % word_bits);
+        }
+        op(word_index, word);
+    }
+}
+
 std::size_t
 Event::Set::hash() const
 {
+    // We hash the bitset version of the set, even if it's stored inline, so
+    // that equal sets have the same hash regardless of their representation.
     static hash_scope scope;
     hst::hasher hash(scope);
-    std::vector<Event> sorted(begin(), end());
-    std::sort(sorted.begin(), sorted.end());
-    for (const Event event : sorted) {
-        hash.add(event);
-    }
+    for_each_word([&hash](std::size_t index, Word word) {
+        hash.add(index).add(word);
+    });
     return hash.value();
 }
 
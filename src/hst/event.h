@@ -8,10 +8,14 @@
 #ifndef HST_EVENT_H
 #define HST_EVENT_H
 
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
 #include <memory>
 #include <ostream>
-#include <set>
 #include <string>
+#include <vector>
 
 namespace hst {
 
@@ -22,12 +26,20 @@ class Event {
   public:
     class Set;
 
-    explicit Event(const std::string& name) : index_(find_or_create_event(name))
+    explicit Event(const std::string& name)
+        : index_(find_or_create_event(name.data(), name.size()))
+    {
+    }
+
+    // Looks up an event without needing a std::string containing its name.
+    Event(const char* name, std::size_t length)
+        : index_(find_or_create_event(name, length))
     {
     }
 
     static Event none() { return Event(0); }
     const std::string& name() const;
+    std::size_t hash() const { return index_; }
 
     bool operator==(const Event& other) const { return index_ == other.index_; }
     bool operator!=(const Event& other) const { return index_ != other.index_; }
@@ -36,39 +48,189 @@ class Event {
     bool operator>(const Event& other) const { return index_ > other.index_; }
     bool operator>=(const Event& other) const { return index_ >= other.index_; }
 
-    static Event tau()
-    {
-        static Event tau("τ");
-        return tau;
-    }
-
-    static Event tick()
-    {
-        static Event tick("✔");
-        return tick;
-    }
+    // τ and ✔ are always the first two events in the table, so we don't have
+    // to look them up.
+    static Event tau() { return Event(tau_index); }
+    static Event tick() { return Event(tick_index); }
 
   private:
     using Index = unsigned int;
     class Table;
 
+    static const Index tau_index = 1;
+    static const Index tick_index = 2;
+
     explicit Event(Index index) : index_(index) {}
 
-    static Index find_or_create_event(const std::string& name);
+    static Index find_or_create_event(const char* name, std::size_t length);
+    static Table& table();
 
-    static std::unique_ptr<Table> table_;
     Index index_;
 };
 
 std::ostream& operator<<(std::ostream& out, const Event& event);
 
-class Event::Set : public std::set<Event> {
+// A set of events.  Small sets are stored inline as a sorted array of event
+// indices.  Once a set grows past that, we choose between a sorted array on the
+// heap and a bitset, depending on how densely packed the set's indices are.
+// The bitset only covers the words between the set's smallest and largest
+// indices, so its size depends on the range of the set, not on the total
+// number of events in the program.  We switch to a bitset when it would be no
+// larger than the sorted array, and back to a sorted array if the bitset grows
+// to more than twice that size.  Either way, iterating through
+// the set yields its events in order of their indices.  Subset tests work a
+// full machine word at a time whenever both sets are bitsets.
+class Event::Set {
+  public:
+    class const_iterator;
+    using iterator = const_iterator;
+    using value_type = Event;
+    using size_type = std::size_t;
+
+    Set() = default;
+    Set(std::initializer_list<Event> events);
+
+    template <typename InputIt>
+    Set(InputIt first, InputIt last)
+    {
+        insert(first, last);
+    }
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    bool empty() const { return size_ == 0; }
+    size_type size() const { return size_; }
+
+    bool contains(Event event) const;
+    size_type count(Event event) const { return contains(event) ? 1 : 0; }
+
+    // Adds `event` to the set, returning whether it wasn't already there.
+    bool insert(Event event);
+
+    template <typename InputIt>
+    void insert(InputIt first, InputIt last)
+    {
+        for (; first != last; ++first) {
+            insert(*first);
+        }
+    }
+
+    // Removes `event` from the set, returning the number of events removed.
+    size_type erase(Event event);
+
+    void clear();
+
+    // Returns whether every event in this set is also in `other`.
+    bool is_subset_of(const Set& other) const;
+
+    bool operator==(const Set& other) const;
+    bool operator!=(const Set& other) const { return !(*this == other); }
+
+    std::size_t hash() const;
+
   private:
-    using Parent = std::set<Event>;
+    using Word = std::uint64_t;
+    static const std::size_t word_bits = 64;
+    static const std::size_t small_capacity = 8;
+
+    bool dense() const { return !words_.empty(); }
+    bool sparse() const { return !sparse_.empty(); }
 
+    // The sorted array of indices, if we're not using a bitset.
+    const Index* sorted() const { return sparse() ? sparse_.data() : small_; }
+
+    // Returns the word of the bitset containing the events whose indices are
+    // `i * word_bits` through `(i + 1) * word_bits - 1`.
+    Word word(std::size_t i) const
+    {
+        return i >= first_word_ && i - first_word_ < words_.size()
+                       ? words_[i - first_word_]
+                       : 0;
+    }
+
+    // Whether a set of `size` events, spanning `word_count` words of a bitset,
+    // is dense enough to store as a bitset.
+    static bool
+    dense_enough(std::size_t size, std::size_t word_count, std::size_t slack)
+    {
+        return word_count * sizeof(Word) <=
+               slack * size * sizeof(Index) + sizeof(Word);
+    }
+
+    // Replaces the contents of this set with `indices`, which must be sorted
+    // and contain no duplicates, choosing the best representation for them.
+    void assign(const std::vector<Index>& indices);
+
+    // Returns the indices of the events in this set, in order.
+    std::vector<Index> indices() const;
+
+    // Calls `op` with the index and contents of each nonzero word of the
+    // bitset version of this set, in order, even if we're storing it as a
+    // sorted array.
+    template <typename F>
+    void for_each_word(F op) const;
+
+    // Used while the set is small.
+    Index small_[small_capacity] = {};
+    // Used once the set is large, if its indices are spread out.
+    std::vector<Index> sparse_;
+    // Used once the set is large, if its indices are densely packed.  The
+    // first element of `words_` is word number `first_word_` of the bitset.
+    std::vector<Word> words_;
+    std::size_t first_word_ = 0;
+    size_type size_ = 0;
+};
+
+class Event::Set::const_iterator {
   public:
-    using Parent::set;
-    std::size_t hash() const;
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Event;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Event*;
+    using reference = Event;
+
+    Event operator*() const { return Event(current_); }
+
+    const_iterator& operator++()
+    {
+        advance(position_ + 1);
+        return *this;
+    }
+
+    const_iterator operator++(int)
+    {
+        const_iterator result = *this;
+        ++*this;
+        return result;
+    }
+
+    bool operator==(const const_iterator& other) const
+    {
+        return position_ == other.position_;
+    }
+
+    bool operator!=(const const_iterator& other) const
+    {
+        return position_ != other.position_;
+    }
+
+  private:
+    friend class Event::Set;
+
+    // For sets stored as a sorted array, `position_` is an offset into the
+    // array; for bitsets, it's a bit offset into `words_`.  Either way, it's
+    // `std::size_t(-1)` for the end iterator.
+    const_iterator(const Set* set, std::size_t position) : set_(set)
+    {
+        advance(position);
+    }
+
+    // Moves to the first element at or after `position`.
+    void advance(std::size_t position);
+
+    const Set* set_;
+    std::size_t position_;
+    Index current_;
 };
 
 std::ostream& operator<<(std::ostream& out, const Event::Set& events);
@@ -82,7 +244,7 @@ struct hash<hst::Event>
 {
     std::size_t operator()(const hst::Event& event) const
     {
-        return std::hash<string>()(event.name());
+        return event.hash();
     }
 };
 
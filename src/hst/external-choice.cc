@@ -7,11 +7,11 @@
 
 #include "hst/environment.h"
 
-#include <functional>
 #include <memory>
 #include <ostream>
 
 #include "hst/event.h"
+#include "hst/function-ref.h"
 #include "hst/hash.h"
 #include "hst/process.h"
 
@@ -26,12 +26,12 @@ class ExternalChoice : public Process {
     {
     }
 
-    void initials(std::function<void(Event)> op) const override;
+    void initials(function_ref<void(Event)> op) const override;
     void afters(Event initial,
-                std::function<void(const Process&)> op) const override;
-    void subprocesses(std::function<void(const Process&)> op) const override;
+                function_ref<void(const Process&)> op) const override;
+    void subprocesses(function_ref<void(const Process&)> op) const override;
 
-    std::size_t hash() const override;
+    std::size_t compute_hash() const override;
     bool operator==(const Process& other) const override;
     unsigned int precedence() const override { return 6; }
     void print(std::ostream& out) const override;
@@ -46,7 +46,7 @@ class ExternalChoice : public Process {
 const Process*
 Environment::external_choice(Process::Set ps)
 {
-    return register_process(new ExternalChoice(this, std::move(ps)));
+    return register_process<ExternalChoice>(this, std::move(ps));
 }
 
 const Process*
@@ -66,7 +66,7 @@ Environment::external_choice(const Process* p, const Process* q)
 //       □ Ps -a→ P'
 
 void
-ExternalChoice::initials(std::function<void(Event)> op) const
+ExternalChoice::initials(function_ref<void(Event)> op) const
 {
     // 1) If P ∈ Ps can perform τ, then □ Ps can perform τ.
     // 2) If P ∈ Ps can perform a ≠ τ, then □ Ps can perform a ≠ τ.
@@ -82,7 +82,7 @@ ExternalChoice::initials(std::function<void(Event)> op) const
 
 void
 ExternalChoice::afters(Event initial,
-                       std::function<void(const Process&)> op) const
+                       function_ref<void(const Process&)> op) const
 {
     // afters(□ Ps, τ) = ⋃ { □ Ps ∖ {P} ∪ {P'} | P ∈ Ps, P' ∈ afters(P, τ) }
     //                                                                  [rule 1]
@@ -96,17 +96,18 @@ ExternalChoice::afters(Event initial,
             // Set Ps' to Ps ∖ {P}
             ps_prime.erase(p);
             // Grab afters(P, τ)
-            Process::Set p_afters;
-            p->afters(initial, &p_afters);
-            for (const Process* p_prime : p_afters) {
+            p->afters(initial, [this, &op, &ps_prime](const Process& p_prime) {
                 // ps_prime currently contains (Ps ∖ {P}).  Add P' to produce
                 // (Ps ∖ {P} ∪ {P'})
-                ps_prime.insert(p_prime);
+                bool added = ps_prime.insert(&p_prime).second;
                 // Create □ (Ps ∖ {P} ∪ {P'}) as a result.
                 op(*env_->external_choice(ps_prime));
-                // Reset Ps' back to Ps ∖ {P}.
-                ps_prime.erase(p_prime);
-            }
+                // Reset Ps' back to Ps ∖ {P}.  (If P' was already in Ps ∖ {P},
+                // then it needs to stay there.)
+                if (added) {
+                    ps_prime.erase(&p_prime);
+                }
+            });
             // Reset Ps' back to Ps.
             ps_prime.insert(p);
         }
@@ -118,7 +119,7 @@ ExternalChoice::afters(Event initial,
 }
 
 void
-ExternalChoice::subprocesses(std::function<void(const Process&)> op) const
+ExternalChoice::subprocesses(function_ref<void(const Process&)> op) const
 {
     for (const Process* process : ps_) {
         op(*process);
@@ -126,7 +127,7 @@ ExternalChoice::subprocesses(std::function<void(const Process&)> op) const
 }
 
 std::size_t
-ExternalChoice::hash() const
+ExternalChoice::compute_hash() const
 {
     static hash_scope external_choice;
     return hasher(external_choice).add(ps_).value();
@@ -0,0 +1,59 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef HST_FUNCTION_REF_H
+#define HST_FUNCTION_REF_H
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace hst {
+
+// A non-owning reference to something callable.  This is like std::function,
+// except that it never allocates, and calling it is a single indirect call.
+// Since it doesn't own the callable that it refers to, you'll almost always
+// only want to use it as the type of a function parameter; the callable (for
+// instance, a lambda that you pass in as the argument) will live at least as
+// long as the call.
+template <typename Signature>
+class function_ref;
+
+template <typename R, typename... Args>
+class function_ref<R(Args...)> {
+  public:
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<
+                      typename std::decay<F>::type, function_ref>::value>::type>
+    function_ref(F&& f)
+        : callable_(const_cast<void*>(
+                  static_cast<const void*>(std::addressof(f)))),
+          callback_(&callback<typename std::remove_reference<F>::type>)
+    {
+    }
+
+    R operator()(Args... args) const
+    {
+        return callback_(callable_, std::forward<Args>(args)...);
+    }
+
+  private:
+    template <typename F>
+    static R callback(void* callable, Args... args)
+    {
+        // The static_cast lets you pass in a callable that returns a value
+        // when R is void; the result is discarded.
+        return static_cast<R>(
+                (*reinterpret_cast<F*>(callable))(std::forward<Args>(args)...));
+    }
+
+    void* callable_;
+    R (*callback_)(void*, Args...);
+};
+
+}  // namespace hst
+#endif  // HST_FUNCTION_REF_H
@@ -8,6 +8,7 @@
 #ifndef HST_HASH_H
 #define HST_HASH_H
 
+#include <cstdint>
 #include <functional>
 
 namespace hst {
@@ -38,5 +39,36 @@ class hasher {
     std::size_t hash_;
 };
 
+// Combines the hashes of the elements of an unordered collection.  The result
+// doesn't depend on the order that you add the elements in, so you don't have
+// to sort the collection first.
+class unordered_hasher {
+  public:
+    template <typename T>
+    unordered_hasher& add(const T& value)
+    {
+        sum_ += mix(std::hash<T>()(value));
+        return *this;
+    }
+
+    std::size_t value() const { return sum_; }
+
+  private:
+    // Addition is a weak way to combine hashes unless each one is well mixed
+    // first, so we run each element's hash through the MurmurHash3 finalizer.
+    static std::size_t mix(std::size_t value)
+    {
+        std::uint64_t x = value;
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return static_cast<std::size_t>(x);
+    }
+
+    std::size_t sum_ = 0;
+};
+
 }  // namespace hst
 #endif  // HST_HASH_H
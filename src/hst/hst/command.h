@@ -23,12 +23,24 @@ class Command {
     std::string name_;
 };
 
+class DivergenceCommand : public Command {
+  public:
+    DivergenceCommand() : Command("divergence") {}
+    void run(int argc, char** argv) override;
+};
+
 class ReachableCommand : public Command {
   public:
     ReachableCommand() : Command("reachable") {}
     void run(int argc, char** argv) override;
 };
 
+class RefinesCommand : public Command {
+  public:
+    RefinesCommand() : Command("refines") {}
+    void run(int argc, char** argv) override;
+};
+
 class TracesCommand : public Command {
   public:
     TracesCommand() : Command("traces") {}
@@ -0,0 +1,91 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "hst/hst/command.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hst/csp0.h"
+#include "hst/environment.h"
+#include "hst/event.h"
+#include "hst/process.h"
+#include "hst/semantic-models.h"
+
+namespace hst {
+
+void
+DivergenceCommand::run(int argc, char** argv)
+{
+    argc--, argv++; /* Command name */
+    if (argc != 1) {
+        std::cerr << "Usage: hst divergence <process>" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::string csp0((argc--, *argv++));
+    Environment env;
+    ParseError error;
+    const Process* process = load_csp0_string(&env, csp0, &error);
+    if (process == nullptr) {
+        std::cerr << "Invalid CSP₀ process \"" << csp0 << "\":" << std::endl
+                  << error << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // We only need to look at the reachable states of the process itself, not
+    // at any product with a spec.  Each state's divergence comes from the
+    // cached τ-SCCs, so the whole search is linear in the size of the process.
+    // We remember how we first reached each state so that we can report a
+    // trace that leads to a divergence.
+    struct Step {
+        const Process* parent;
+        Event event;
+    };
+    std::unordered_map<const Process*, Step> steps;
+    std::vector<const Process*> queue{process};
+    steps.emplace(process, Step{nullptr, Event::none()});
+    const Process* divergent = nullptr;
+    for (std::size_t i = 0; i < queue.size(); ++i) {
+        const Process* current = queue[i];
+        if (env.diverges(*current)) {
+            divergent = current;
+            break;
+        }
+        current->transitions([current, &steps, &queue](Event initial,
+                                                       const Process& after) {
+            if (steps.emplace(&after, Step{current, initial}).second) {
+                queue.push_back(&after);
+            }
+        });
+    }
+
+    if (!divergent) {
+        std::cout << "Process is divergence-free" << std::endl;
+        return;
+    }
+
+    std::vector<Event> events;
+    for (const Process* current = divergent; current != process;) {
+        const Step& step = steps.find(current)->second;
+        if (step.event != Event::tau()) {
+            events.push_back(step.event);
+        }
+        current = step.parent;
+    }
+    std::reverse(events.begin(), events.end());
+    std::cout << "Process can diverge" << std::endl
+              << "Trace: " << Trace(std::move(events)) << std::endl
+              << "Divergent process: " << *divergent << std::endl;
+}
+
+}  // namespace hst
@@ -11,9 +11,12 @@
 
 #include "hst/hst/command.h"
 
+static hst::DivergenceCommand divergence;
 static hst::ReachableCommand reachable;
+static hst::RefinesCommand refines;
 static hst::TracesCommand traces;
-static std::vector<hst::Command*> commands{&reachable, &traces};
+static std::vector<hst::Command*> commands{&divergence, &reachable, &refines,
+                                           &traces};
 
 int
 main(int argc, char** argv)
@@ -8,6 +8,7 @@
 #include "hst/hst/command.h"
 
 #include <getopt.h>
+#include <cstdlib>
 #include <iostream>
 #include <string>
 
@@ -21,17 +22,31 @@ void
 ReachableCommand::run(int argc, char** argv)
 {
     bool verbose = false;
-    static struct option options[] = {{"verbose", no_argument, 0, 'v'},
+    unsigned int threads = 1;
+    static struct option options[] = {{"threads", required_argument, 0, 't'},
+                                      {"verbose", no_argument, 0, 'v'},
                                       {0, 0, 0, 0}};
 
     while (true) {
         int option_index = 0;
-        int c = getopt_long(argc, argv, "v", options, &option_index);
+        int c = getopt_long(argc, argv, "t:v", options, &option_index);
         if (c == -1) {
             break;
         }
 
         switch (c) {
+            case 't': {
+                char* end;
+                long value = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || value < 1) {
+                    std::cerr << "Invalid thread count \"" << optarg << "\""
+                              << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                threads = value;
+                break;
+            }
+
             case 'v':
                 verbose = true;
                 break;
@@ -43,7 +58,8 @@ ReachableCommand::run(int argc, char** argv)
     argc -= optind, argv += optind;
 
     if (argc != 1) {
-        std::cerr << "Usage: hst reachable [-v] <process>" << std::endl;
+        std::cerr << "Usage: hst reachable [-v] [-t <threads>] <process>"
+                  << std::endl;
         exit(EXIT_FAILURE);
     }
 
@@ -58,7 +74,7 @@ ReachableCommand::run(int argc, char** argv)
     }
 
     unsigned long count = 0;
-    process->bfs([&count, verbose](const Process& process) {
+    process->parallel_bfs(threads, [&count, verbose](const Process& process) {
         if (verbose) {
             std::cout << process << std::endl;
         }
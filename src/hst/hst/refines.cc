@@ -0,0 +1,354 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "hst/hst/command.h"
+
+#include <getopt.h>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "hst/csp0.h"
+#include "hst/environment.h"
+#include "hst/event.h"
+#include "hst/probabilistic-set.h"
+#include "hst/process.h"
+#include "hst/refinement.h"
+#include "hst/semantic-models.h"
+
+namespace hst {
+
+namespace {
+
+const Process*
+require_csp0(Environment* env, const std::string& csp0)
+{
+    ParseError error;
+    const Process* process = load_csp0_string(env, csp0, &error);
+    if (process == nullptr) {
+        std::cerr << "Invalid CSP₀ process \"" << csp0 << "\":" << std::endl
+                  << error << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return process;
+}
+
+struct RefinesOptions {
+    bool lazy = false;
+    RefinementSearch search = RefinementSearch::breadth_first;
+    std::size_t max_depth = 0;
+    unsigned int threads = 1;
+    unsigned int bitstate_bits = 0;
+    unsigned int hash_count = 0;
+    unsigned int hash_compaction_slots = 0;
+    unsigned int fingerprint_bits = 0;
+    std::string external_directory;
+    std::size_t run_size = std::size_t(1) << 24;
+};
+
+template <typename Model>
+void
+report(bool holds, const RefinementCounterexample& counterexample,
+       const RefinesOptions& options)
+{
+    if (holds) {
+        if (options.max_depth != 0) {
+            std::cout << "Refinement holds up to depth " << options.max_depth
+                      << std::endl;
+        } else {
+            std::cout << "Refinement holds" << std::endl;
+        }
+        return;
+    }
+
+    std::cout << "Refinement does not hold" << std::endl
+              << "Trace: " << counterexample.trace << std::endl
+              << "Spec: " << *counterexample.spec << std::endl
+              << "Impl: " << *counterexample.impl << std::endl;
+    if (counterexample.event != Event::none()) {
+        std::cout << "Impl can perform " << counterexample.event
+                  << ", but spec cannot" << std::endl;
+    } else {
+        std::cout << "Spec behavior: "
+                  << Model::get_process_behavior(*counterexample.spec)
+                  << std::endl
+                  << "Impl behavior: "
+                  << Model::get_process_behavior(*counterexample.impl)
+                  << std::endl;
+    }
+}
+
+template <typename Model>
+void
+check_refinement(Environment* env, const Process* spec, const Process* impl,
+                 const RefinesOptions& options)
+{
+    // In lazy mode, we check against the prenormalized spec directly, so that
+    // we only explore the parts of the spec that the check actually reaches.
+    const NormalizedProcess* normalized = env->prenormalize(spec);
+    if (!options.lazy) {
+        normalized = env->normalize<Model>(normalized, options.threads);
+    }
+    std::unique_ptr<ProbabilisticSet> visited;
+    if (options.bitstate_bits != 0) {
+        visited.reset(new BitstateSet(options.bitstate_bits,
+                                      options.hash_count ? options.hash_count
+                                                         : 3));
+    } else if (options.hash_compaction_slots != 0) {
+        visited.reset(new HashCompactionSet(
+                options.hash_compaction_slots,
+                options.fingerprint_bits ? options.fingerprint_bits : 64));
+    }
+    RefinementChecker<Model> checker(options.search, options.max_depth,
+                                     visited.get());
+    checker.set_external_storage(options.external_directory, options.run_size);
+    RefinementCounterexample counterexample;
+    bool holds = checker.refines(normalized, impl, options.threads,
+                                 &counterexample);
+    if (visited) {
+        std::cout << "Visited pairs: " << visited->size() << std::endl
+                  << "Estimated probability of missed pairs: "
+                  << visited->omission_probability() << std::endl;
+    }
+    report<Model>(holds, counterexample, options);
+}
+
+// Checks traces refinement with the antichain checker, which doesn't need to
+// normalize the spec.
+void
+check_antichain_refinement(const Process* spec, const Process* impl,
+                           const RefinesOptions& options)
+{
+    AntichainRefinementChecker checker;
+    RefinementCounterexample counterexample;
+    bool holds = checker.refines(spec, impl, &counterexample);
+    report<Traces>(holds, counterexample, options);
+}
+
+}  // namespace
+
+void
+RefinesCommand::run(int argc, char** argv)
+{
+    RefinesOptions opts;
+    std::string model = "T";
+    bool antichain = false;
+    bool external = false;
+    static struct option options[] = {
+            {"antichain", no_argument, 0, 'a'},
+            {"bitstate", required_argument, 0, 'b'},
+            {"hash-compaction", required_argument, 0, 'c'},
+            {"depth-first", no_argument, 0, 'd'},
+            {"fingerprint-bits", required_argument, 0, 'f'},
+            {"hash-count", required_argument, 0, 'k'},
+            {"lazy", no_argument, 0, 'l'},
+            {"max-depth", required_argument, 0, 'm'},
+            {"model", required_argument, 0, 'M'},
+            {"run-size", required_argument, 0, 'r'},
+            {"threads", required_argument, 0, 't'},
+            {"external", required_argument, 0, 'x'},
+            {0, 0, 0, 0}};
+
+    while (true) {
+        int option_index = 0;
+        int c = getopt_long(argc, argv, "ab:c:df:k:lm:M:r:t:x:", options,
+                            &option_index);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'a':
+                antichain = true;
+                break;
+
+            case 'b': {
+                char* end;
+                long value = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || value < 6 ||
+                    value > 40) {
+                    std::cerr << "Invalid bitstate size \"" << optarg << "\""
+                              << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                // The probabilistic modes are only supported by the
+                // depth-first search.
+                opts.search = RefinementSearch::depth_first;
+                opts.bitstate_bits = value;
+                break;
+            }
+
+            case 'c': {
+                char* end;
+                long value = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || value < 6 ||
+                    value > 40) {
+                    std::cerr << "Invalid hash compaction table size \""
+                              << optarg << "\"" << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                opts.search = RefinementSearch::depth_first;
+                opts.hash_compaction_slots = value;
+                break;
+            }
+
+            case 'k': {
+                char* end;
+                long value = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || value < 1 ||
+                    value > 64) {
+                    std::cerr << "Invalid hash count \"" << optarg << "\""
+                              << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                opts.hash_count = value;
+                break;
+            }
+
+            case 'd':
+                opts.search = RefinementSearch::depth_first;
+                break;
+
+            case 'f': {
+                char* end;
+                long value = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || value < 8 ||
+                    value > 64) {
+                    std::cerr << "Invalid fingerprint size \"" << optarg
+                              << "\"" << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                opts.fingerprint_bits = value;
+                break;
+            }
+
+            case 'l':
+                opts.lazy = true;
+                break;
+
+            case 'm': {
+                char* end;
+                long value = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || value < 1) {
+                    std::cerr << "Invalid maximum depth \"" << optarg << "\""
+                              << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                // A depth bound only makes sense for a depth-first search.
+                opts.search = RefinementSearch::depth_first;
+                opts.max_depth = value;
+                break;
+            }
+
+            case 'M':
+                model = optarg;
+                if (model != "T" && model != "F" && model != "FD") {
+                    std::cerr << "Invalid semantic model \"" << optarg << "\""
+                              << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'r': {
+                char* end;
+                long value = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || value < 1) {
+                    std::cerr << "Invalid run size \"" << optarg << "\""
+                              << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                opts.run_size = value;
+                break;
+            }
+
+            case 't': {
+                char* end;
+                long value = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || value < 1) {
+                    std::cerr << "Invalid thread count \"" << optarg << "\""
+                              << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                opts.threads = value;
+                break;
+            }
+
+            case 'x':
+                external = true;
+                opts.external_directory = optarg;
+                break;
+
+            default:
+                exit(EXIT_FAILURE);
+        }
+    }
+    argc -= optind, argv += optind;
+
+    if (argc != 2) {
+        std::cerr << "Usage: hst refines [-M T|F|FD] [-a] [-d] [-l] "
+                     "[-m <depth>] [-t <threads>] "
+                     "[-b <log2 bits> [-k <hashes>] | "
+                     "-c <log2 slots> [-f <bits>]] "
+                     "[-x <directory> [-r <pairs>]] <spec> <impl>"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (external && opts.search == RefinementSearch::depth_first) {
+        std::cerr << "--external can't be combined with a depth-first search"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (antichain && (model != "T" || opts.lazy ||
+                      opts.search != RefinementSearch::breadth_first ||
+                      external)) {
+        std::cerr << "--antichain only supports a breadth-first traces check"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (antichain && opts.threads != 1) {
+        std::cerr << "--antichain can't be combined with --threads"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (external) {
+        opts.search = RefinementSearch::external_breadth_first;
+    }
+    if (opts.bitstate_bits != 0 && opts.hash_compaction_slots != 0) {
+        std::cerr << "Cannot use --bitstate and --hash-compaction together"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts.hash_count != 0 && opts.bitstate_bits == 0) {
+        std::cerr << "--hash-count requires --bitstate" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts.fingerprint_bits != 0 && opts.hash_compaction_slots == 0) {
+        std::cerr << "--fingerprint-bits requires --hash-compaction"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::string spec_csp0((argc--, *argv++));
+    std::string impl_csp0((argc--, *argv++));
+    Environment env;
+    const Process* spec = require_csp0(&env, spec_csp0);
+    const Process* impl = require_csp0(&env, impl_csp0);
+
+    if (antichain) {
+        check_antichain_refinement(spec, impl, opts);
+    } else if (model == "F") {
+        check_refinement<Failures>(&env, spec, impl, opts);
+    } else if (model == "FD") {
+        check_refinement<FailuresDivergences>(&env, spec, impl, opts);
+    } else {
+        check_refinement<Traces>(&env, spec, impl, opts);
+    }
+}
+
+}  // namespace hst
@@ -8,10 +8,10 @@
 #include "hst/environment.h"
 
 #include <algorithm>
-#include <functional>
 #include <string>
 
 #include "hst/event.h"
+#include "hst/function-ref.h"
 #include "hst/hash.h"
 #include "hst/process.h"
 
@@ -26,25 +26,25 @@ class Interleave : public Process {
     {
     }
 
-    void initials(std::function<void(Event)> op) const override;
+    void initials(function_ref<void(Event)> op) const override;
     void afters(Event initial,
-                std::function<void(const Process&)> op) const override;
-    void subprocesses(std::function<void(const Process&)> op) const override;
+                function_ref<void(const Process&)> op) const override;
+    void subprocesses(function_ref<void(const Process&)> op) const override;
 
-    std::size_t hash() const override;
+    std::size_t compute_hash() const override;
     bool operator==(const Process& other) const override;
     unsigned int precedence() const override { return 7; }
     void print(std::ostream& out) const override;
 
   private:
     void
-    normal_afters(Event initial, std::function<void(const Process&)> op) const;
+    normal_afters(Event initial, function_ref<void(const Process&)> op) const;
 
     void
-    tau_afters(Event initial, std::function<void(const Process&)> op) const;
+    tau_afters(Event initial, function_ref<void(const Process&)> op) const;
 
     void
-    tick_afters(Event initial, std::function<void(const Process&)> op) const;
+    tick_afters(Event initial, function_ref<void(const Process&)> op) const;
 
     Environment* env_;
     Process::Bag ps_;
@@ -55,7 +55,7 @@ class Interleave : public Process {
 const Process*
 Environment::interleave(Process::Bag ps)
 {
-    return register_process(new Interleave(this, std::move(ps)));
+    return register_process<Interleave>(this, std::move(ps));
 }
 
 const Process*
@@ -82,7 +82,7 @@ Environment::interleave(const Process* p, const Process* q)
 //       ⫴ {Ω} -✔→ Ω
 
 void
-Interleave::initials(std::function<void(Event)> op) const
+Interleave::initials(function_ref<void(Event)> op) const
 {
     // initials(⫴ Ps) = ⋃ { initials(P) ∩ {τ} | P ∈ Ps }                [rule 1]
     //                ∪ ⋃ { initials(P) ∖ {τ,✔} | P ∈ Ps }              [rule 2]
@@ -116,7 +116,7 @@ Interleave::initials(std::function<void(Event)> op) const
 
 void
 Interleave::normal_afters(Event initial,
-                          std::function<void(const Process&)> op) const
+                          function_ref<void(const Process&)> op) const
 {
     // afters(⫴ Ps, a ∉ {τ,✔}) = ⋃ { ⫴ Ps ∖ {P} ∪ {P'} |
     //                                  P ∈ Ps, P' ∈ afters(P, a) }     [rule 2]
@@ -145,7 +145,7 @@ Interleave::normal_afters(Event initial,
 
 void
 Interleave::tau_afters(Event initial,
-                       std::function<void(const Process&)> op) const
+                       function_ref<void(const Process&)> op) const
 {
     // afters(⫴ Ps, τ) = ⋃ { ⫴ Ps ∖ {P} ∪ {P'} | P ∈ Ps, P' ∈ afters(P, τ) }
     //                                                                  [rule 1]
@@ -180,7 +180,7 @@ Interleave::tau_afters(Event initial,
 
 void
 Interleave::tick_afters(Event initial,
-                        std::function<void(const Process&)> op) const
+                        function_ref<void(const Process&)> op) const
 {
     // afters(⫴ {Ω}, ✔) = {Ω}                                           [rule 4]
     bool has_non_omega =
@@ -201,7 +201,7 @@ Interleave::tick_afters(Event initial,
 }
 
 void
-Interleave::afters(Event initial, std::function<void(const Process&)> op) const
+Interleave::afters(Event initial, function_ref<void(const Process&)> op) const
 {
     if (initial == Event::tau()) {
         tau_afters(initial, op);
@@ -213,7 +213,7 @@ Interleave::afters(Event initial, std::function<void(const Process&)> op) const
 }
 
 void
-Interleave::subprocesses(std::function<void(const Process&)> op) const
+Interleave::subprocesses(function_ref<void(const Process&)> op) const
 {
     for (const Process* process : ps_) {
         op(*process);
@@ -221,7 +221,7 @@ Interleave::subprocesses(std::function<void(const Process&)> op) const
 }
 
 std::size_t
-Interleave::hash() const
+Interleave::compute_hash() const
 {
     static hash_scope internal_choice;
     return hasher(internal_choice).add(ps_).value();
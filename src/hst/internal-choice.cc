@@ -7,11 +7,11 @@
 
 #include "hst/environment.h"
 
-#include <functional>
 #include <memory>
 #include <ostream>
 
 #include "hst/event.h"
+#include "hst/function-ref.h"
 #include "hst/hash.h"
 #include "hst/process.h"
 
@@ -22,12 +22,12 @@ namespace {
 class InternalChoice : public Process {
   public:
     explicit InternalChoice(Process::Set ps) : ps_(std::move(ps)) {}
-    void initials(std::function<void(Event)> op) const override;
+    void initials(function_ref<void(Event)> op) const override;
     void afters(Event initial,
-                std::function<void(const Process&)> op) const override;
-    void subprocesses(std::function<void(const Process&)> op) const override;
+                function_ref<void(const Process&)> op) const override;
+    void subprocesses(function_ref<void(const Process&)> op) const override;
 
-    std::size_t hash() const override;
+    std::size_t compute_hash() const override;
     bool operator==(const Process& other) const override;
     unsigned int precedence() const override { return 7; }
     void print(std::ostream& out) const override;
@@ -41,7 +41,7 @@ class InternalChoice : public Process {
 const Process*
 Environment::internal_choice(Process::Set ps)
 {
-    return register_process(new InternalChoice(std::move(ps)));
+    return register_process<InternalChoice>(std::move(ps));
 }
 
 const Process*
@@ -56,7 +56,7 @@ Environment::internal_choice(const Process* p, const Process* q)
 //     ⊓ Ps -τ→ P
 
 void
-InternalChoice::initials(std::function<void(Event)> op) const
+InternalChoice::initials(function_ref<void(Event)> op) const
 {
     // initials(⊓ Ps) = {τ}
     op(Event::tau());
@@ -64,7 +64,7 @@ InternalChoice::initials(std::function<void(Event)> op) const
 
 void
 InternalChoice::afters(Event initial,
-                       std::function<void(const Process&)> op) const
+                       function_ref<void(const Process&)> op) const
 {
     // afters(⊓ Ps, τ) = Ps
     if (initial == Event::tau()) {
@@ -75,7 +75,7 @@ InternalChoice::afters(Event initial,
 }
 
 void
-InternalChoice::subprocesses(std::function<void(const Process&)> op) const
+InternalChoice::subprocesses(function_ref<void(const Process&)> op) const
 {
     for (const Process* process : ps_) {
         op(*process);
@@ -83,7 +83,7 @@ InternalChoice::subprocesses(std::function<void(const Process&)> op) const
 }
 
 std::size_t
-InternalChoice::hash() const
+InternalChoice::compute_hash() const
 {
     static hash_scope internal_choice;
     return hasher(internal_choice).add(ps_).value();
@@ -7,13 +7,18 @@
 
 #include "hst/environment.h"
 
+#include <algorithm>
 #include <assert.h>
-#include <functional>
+#include <cstdint>
 #include <memory>
 #include <ostream>
+#include <thread>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "hst/event.h"
+#include "hst/function-ref.h"
 #include "hst/hash.h"
 #include "hst/process.h"
 #include "hst/semantic-models.h"
@@ -22,172 +27,551 @@ namespace hst {
 
 namespace {
 
-class Equivalences {
+// A flattened copy of the graph of prenormalized processes reachable from some
+// root.  Each process gets a dense ID, in the order that a breadth-first search
+// encounters them, so the root is always state 0.  Each state's outgoing
+// transitions are stored in compressed sparse row format, sorted by event.
+// (Prenormalized processes are deterministic, so there's at most one outgoing
+// transition for any event.)
+class FlatGraph {
   public:
-    using Head = const NormalizedProcess*;
-    using ClassMap = std::unordered_map<const NormalizedProcess*, Head>;
-    using MemberSet = std::unordered_set<const NormalizedProcess*>;
-    using MemberMap = std::unordered_map<Head, MemberSet>;
+    using State = std::uint32_t;
 
-    void add(Head head, const NormalizedProcess* process)
+    explicit FlatGraph(const NormalizedProcess* root);
+
+    State size() const { return states_.size(); }
+    const NormalizedProcess* process(State state) const
     {
-        classes_[process] = head;
-        members_[head].insert(process);
+        return states_[state];
     }
 
-    Head get_class(const NormalizedProcess* process) const
+    // Calls `op` for each outgoing transition of `state`.
+    template <typename F>
+    void transitions(State state, F op) const
     {
-        auto it = classes_.find(process);
-        if (it == classes_.end()) {
-            return nullptr;
-        } else {
-            return it->second;
+        for (std::uint32_t i = begin_[state]; i < begin_[state + 1]; i++) {
+            op(events_[i], targets_[i]);
         }
     }
 
-    const MemberMap& get_classes() const { return members_; }
-    const MemberSet& get_members(Head head) const
+    // The outgoing transitions of `state` are the ones numbered from
+    // `first_transition(state)` up to (but not including)
+    // `first_transition(state + 1)`.
+    std::uint32_t first_transition(State state) const { return begin_[state]; }
+    Event event(std::uint32_t transition) const { return events_[transition]; }
+    State target(std::uint32_t transition) const
     {
-        auto it = members_.find(head);
-        assert(it != members_.end());
-        return it->second;
+        return targets_[transition];
     }
 
   private:
-    ClassMap classes_;
-    MemberMap members_;
+    std::vector<const NormalizedProcess*> states_;
+    std::vector<std::uint32_t> begin_;
+    std::vector<Event> events_;
+    std::vector<State> targets_;
 };
 
-template <typename Model>
-Equivalences
-initialize_bisimulation(const NormalizedProcess* root)
+FlatGraph::FlatGraph(const NormalizedProcess* root)
 {
-    Equivalences result;
-    std::unordered_map<typename Model::Behavior, Equivalences::Head> behaviors;
-    root->bfs([&behaviors, &result](const NormalizedProcess& process) {
-        auto behavior = Model::get_process_behavior(process);
-        Equivalences::Head& head = behaviors[behavior];
-        if (!head) {
-            // This is the first process we've encountered with this behavior,
-            // so use it as the head of the equivalence class.
-            head = &process;
-        }
-        result.add(head, &process);
-        return true;
+    std::unordered_map<const NormalizedProcess*, State> ids;
+    root->bfs([this, &ids](const NormalizedProcess& process) {
+        ids.emplace(&process, states_.size());
+        states_.push_back(&process);
     });
-    return result;
+
+    Event::Set initials;
+    begin_.reserve(states_.size() + 1);
+    for (const NormalizedProcess* process : states_) {
+        begin_.push_back(events_.size());
+        initials.clear();
+        process->initials(&initials);
+        for (Event initial : initials) {
+            const NormalizedProcess* after = process->after(initial);
+            assert(after);
+            events_.push_back(initial);
+            targets_.push_back(ids.find(after)->second);
+        }
+    }
+    begin_.push_back(events_.size());
 }
 
-// Check whether two processes are shallowly equivalent: that is, whether they
-// belong to the same equivalence class.
-bool
-processes_shallow_equiv(const Equivalences& equivalences,
-                        const NormalizedProcess* p1,
-                        const NormalizedProcess* p2)
+// Finds the coarsest bisimulation of a FlatGraph that respects the initial
+// partition you give it, using Hopcroft's partition refinement algorithm
+// (generalized to partial transition functions as described by Valmari and
+// Lehtinen).  This takes O(m log n) time, where n is the number of states and m
+// is the number of transitions.
+//
+// The states are kept in a single array, with the members of each block stored
+// contiguously.  When we use a block as a splitter, we look at every transition
+// into it, grouped by event; for each event, we move the states that have a
+// transition into the splitter to the front of their own blocks, and then split
+// off those moved states into a new block.
+class PartitionRefinement {
+  public:
+    using Block = std::uint32_t;
+    using State = FlatGraph::State;
+
+    // `blocks` must assign each state of `graph` to a block; the block IDs must
+    // be dense, starting from 0.
+    PartitionRefinement(const FlatGraph& graph, std::vector<Block> blocks);
+
+    void refine();
+
+    // Returns the block that each state belongs to.
+    const std::vector<Block>& blocks() const { return block_of_; }
+
+  private:
+    struct Predecessor {
+        Event event;
+        State state;
+        bool operator<(const Predecessor& other) const
+        {
+            return event < other.event ||
+                   (event == other.event && state < other.state);
+        }
+    };
+
+    void mark(State state);
+    void split_marked();
+
+    // Inverse transitions, in compressed sparse row format.
+    std::vector<std::uint32_t> predecessors_begin_;
+    std::vector<Predecessor> predecessors_;
+
+    std::vector<State> elements_;        // grouped by block
+    std::vector<std::uint32_t> location_;  // index of each state in elements_
+    std::vector<Block> block_of_;
+    std::vector<std::uint32_t> first_;   // first element of each block
+    std::vector<std::uint32_t> end_;     // one past the last element
+    std::vector<std::uint32_t> marked_;  // number of marked elements
+    std::vector<Block> touched_;
+    std::vector<Block> worklist_;
+};
+
+PartitionRefinement::PartitionRefinement(const FlatGraph& graph,
+                                         std::vector<Block> blocks)
+    : location_(graph.size()), block_of_(std::move(blocks))
+{
+    // Build the inverse transitions.
+    State size = graph.size();
+    predecessors_begin_.assign(size + 1, 0);
+    for (State state = 0; state < size; state++) {
+        graph.transitions(state, [this](Event, State target) {
+            predecessors_begin_[target + 1]++;
+        });
+    }
+    for (State state = 0; state < size; state++) {
+        predecessors_begin_[state + 1] += predecessors_begin_[state];
+    }
+    predecessors_.assign(predecessors_begin_[size],
+                         Predecessor{Event::none(), 0});
+    std::vector<std::uint32_t> next(predecessors_begin_.begin(),
+                                    predecessors_begin_.end() - 1);
+    for (State state = 0; state < size; state++) {
+        graph.transitions(state, [this, &next, state](Event event,
+                                                      State target) {
+            predecessors_[next[target]++] = Predecessor{event, state};
+        });
+    }
+
+    // Lay out the states grouped by block.
+    Block block_count = 0;
+    for (Block block : block_of_) {
+        block_count = std::max(block_count, block + 1);
+    }
+    first_.assign(block_count + 1, 0);
+    for (Block block : block_of_) {
+        first_[block + 1]++;
+    }
+    for (Block block = 0; block < block_count; block++) {
+        first_[block + 1] += first_[block];
+    }
+    first_.pop_back();
+    end_ = first_;
+    elements_.resize(size);
+    for (State state = 0; state < size; state++) {
+        std::uint32_t& position = end_[block_of_[state]];
+        elements_[position] = state;
+        location_[state] = position++;
+    }
+    marked_.assign(block_count, 0);
+
+    // With a partial transition function, we can't skip any of the initial
+    // blocks as splitters.
+    for (Block block = 0; block < block_count; block++) {
+        worklist_.push_back(block);
+    }
+}
+
+void
+PartitionRefinement::mark(State state)
+{
+    Block block = block_of_[state];
+    std::uint32_t position = location_[state];
+    std::uint32_t marked_end = first_[block] + marked_[block];
+    if (position < marked_end) {
+        return;
+    }
+    if (marked_[block] == 0) {
+        touched_.push_back(block);
+    }
+    State other = elements_[marked_end];
+    std::swap(elements_[position], elements_[marked_end]);
+    location_[other] = position;
+    location_[state] = marked_end;
+    marked_[block]++;
+}
+
+void
+PartitionRefinement::split_marked()
+{
+    for (Block block : touched_) {
+        std::uint32_t first = first_[block];
+        std::uint32_t middle = first + marked_[block];
+        std::uint32_t end = end_[block];
+        marked_[block] = 0;
+        if (middle == end) {
+            // Every state in the block was marked, so there's nothing to split.
+            continue;
+        }
+
+        // The smaller half becomes the new block, so that we only have to
+        // relabel the states in the smaller half.
+        Block new_block = first_.size();
+        if (middle - first <= end - middle) {
+            first_.push_back(first);
+            end_.push_back(middle);
+            first_[block] = middle;
+        } else {
+            first_.push_back(middle);
+            end_.push_back(end);
+            end_[block] = middle;
+        }
+        marked_.push_back(0);
+        for (std::uint32_t i = first_[new_block]; i < end_[new_block]; i++) {
+            block_of_[elements_[i]] = new_block;
+        }
+
+        // If the old block is still in the worklist, it now only contains the
+        // larger half, so adding the new block makes sure that we split by
+        // both halves.  Otherwise, splitting by the smaller half is enough,
+        // since we've already split by the union of the two halves.  The new
+        // block is the smaller half, so either way it's the only one that we
+        // add, and no block is ever in the worklist more than once.
+        worklist_.push_back(new_block);
+    }
+    touched_.clear();
+}
+
+void
+PartitionRefinement::refine()
+{
+    std::vector<Predecessor> incoming;
+    while (!worklist_.empty()) {
+        Block splitter = worklist_.back();
+        worklist_.pop_back();
+
+        // Collect every transition into the splitter, grouped by event.  We
+        // have to do this before splitting anything, since the splitter itself
+        // might get split.
+        incoming.clear();
+        for (std::uint32_t i = first_[splitter]; i < end_[splitter]; i++) {
+            State state = elements_[i];
+            incoming.insert(incoming.end(),
+                            predecessors_.begin() + predecessors_begin_[state],
+                            predecessors_.begin() +
+                                    predecessors_begin_[state + 1]);
+        }
+        std::sort(incoming.begin(), incoming.end());
+
+        for (auto it = incoming.begin(); it != incoming.end();) {
+            Event event = it->event;
+            for (; it != incoming.end() && it->event == event; ++it) {
+                mark(it->state);
+            }
+            split_marked();
+        }
+    }
+}
+
+// Finds the same coarsest bisimulation as PartitionRefinement, but using
+// `threads` worker threads.  Instead of using splitters, we proceed in rounds.
+// In each round, we calculate the signature of each state (its current block,
+// along with the block that each of its outgoing transitions leads to), and
+// then renumber the blocks so that states end up in the same block if and only
+// if they have the same signature.  We stop once a round doesn't split any
+// blocks.  Calculating the signatures is the expensive part, and can be done
+// for each state independently, so that's what we spread across the threads.
+class SignatureRefinement {
+  public:
+    using Block = std::uint32_t;
+    using State = FlatGraph::State;
+
+    SignatureRefinement(const FlatGraph& graph, std::vector<Block> blocks,
+                        unsigned int threads)
+        : graph_(graph),
+          threads_(threads),
+          block_of_(std::move(blocks)),
+          hashes_(graph.size())
+    {
+    }
+
+    void refine();
+
+    // Returns the block that each state belongs to.
+    const std::vector<Block>& blocks() const { return block_of_; }
+
+  private:
+    void hash_signatures(State begin, State end);
+    bool same_signature(State s1, State s2) const;
+
+    // Renumbers each block by signature, returning the number of blocks.
+    Block renumber();
+
+    const FlatGraph& graph_;
+    unsigned int threads_;
+    std::vector<Block> block_of_;
+    std::vector<std::size_t> hashes_;
+};
+
+void
+SignatureRefinement::hash_signatures(State begin, State end)
 {
-    Equivalences::Head head1 = equivalences.get_class(p1);
-    Equivalences::Head head2 = equivalences.get_class(p2);
-    assert(head1 && head2);
-    return head1 == head2;
+    static hash_scope signature;
+    for (State state = begin; state < end; state++) {
+        hasher hash(signature);
+        hash.add(block_of_[state]);
+        graph_.transitions(state, [this, &hash](Event event, State target) {
+            hash.add(event).add(block_of_[target]);
+        });
+        hashes_[state] = hash.value();
+    }
 }
 
-// Check whether two processes are deeply equivalent: that all of the targets
-// from both lead to processes that are shallowly equivalent.
 bool
-processes_deep_equiv(const Equivalences& equivalences,
-                     const NormalizedProcess* p1, const NormalizedProcess* p2)
+SignatureRefinement::same_signature(State s1, State s2) const
 {
-    Event::Set initials;
-    p1->initials(&initials);
-    for (Event initial : initials) {
-        const NormalizedProcess* after1 = p1->after(initial);
-        const NormalizedProcess* after2 = p2->after(initial);
-        assert(after1 && after2);
-        if (!processes_shallow_equiv(equivalences, after1, after2)) {
+    if (block_of_[s1] != block_of_[s2]) {
+        return false;
+    }
+    // Transitions are sorted by event, so we can compare them in order,
+    // straight out of the graph.
+    std::uint32_t i1 = graph_.first_transition(s1);
+    std::uint32_t end1 = graph_.first_transition(s1 + 1);
+    std::uint32_t i2 = graph_.first_transition(s2);
+    std::uint32_t end2 = graph_.first_transition(s2 + 1);
+    if (end1 - i1 != end2 - i2) {
+        return false;
+    }
+    for (; i1 < end1; i1++, i2++) {
+        if (graph_.event(i1) != graph_.event(i2) ||
+            block_of_[graph_.target(i1)] != block_of_[graph_.target(i2)]) {
             return false;
         }
     }
     return true;
 }
 
-template <typename Model>
-std::unique_ptr<Equivalences>
-bisimulate(const NormalizedProcess* root)
+SignatureRefinement::Block
+SignatureRefinement::renumber()
 {
-    bool changed;
-    Equivalences prev_equiv = initialize_bisimulation<Model>(root);
-    Equivalences next_equiv;
-
-    do {
-        // We don't want to start another iteration after this one unless we
-        // find any changes.
-        changed = false;
-
-        // Loop through each pair of states that were equivalent before,
-        // verifying that they're still equivalent.  Separate any that are not
-        // equivalent to their head into a new class.
-        for (const auto& head_and_members : prev_equiv.get_classes()) {
-            Equivalences::Head head = head_and_members.first;
-            Equivalences::Head new_head = nullptr;
-            const auto& members = head_and_members.second;
-            assert(!members.empty());
-
-            for (const NormalizedProcess* member : members) {
-                // If we find a non-equivalent member of this class, we'll need
-                // to separate it out into a new class.  This new class will
-                // need a head, which will be the first non-equivalent member we
-                // find.
-                //
-                // If we find multiple members that aren't equivalent to the
-                // head, we'll put them into the same new equivalence class; if
-                // they turn out to also not be equivalent to each other, we'll
-                // catch that in a later iteration.
-
-                if (processes_deep_equiv(prev_equiv, head, member)) {
-                    // This process is equivalent to its previous head; keep it
-                    // in the same equivalence class as head in the next round.
-                    next_equiv.add(head, member);
-                } else {
-                    // This state is not equivalent to its previous head.  If
-                    // necessary, create a new equivalence class.  Add the node
-                    // to this new class.
-                    if (!new_head) {
-                        new_head = member;
-                    }
-                    next_equiv.add(new_head, member);
-                    changed = true;
-                }
+    // Maps each signature hash to the states (one per distinct signature) that
+    // we've seen with that hash, so that we can detect hash collisions.
+    std::unordered_map<std::size_t, std::vector<State>> representatives;
+    std::vector<Block> new_blocks(graph_.size());
+    Block next_block = 0;
+    for (State state = 0; state < graph_.size(); state++) {
+        std::vector<State>& candidates = representatives[hashes_[state]];
+        bool found = false;
+        for (State candidate : candidates) {
+            if (same_signature(state, candidate)) {
+                new_blocks[state] = new_blocks[candidate];
+                found = true;
+                break;
             }
         }
+        if (!found) {
+            candidates.push_back(state);
+            new_blocks[state] = next_block++;
+        }
+    }
+    block_of_ = std::move(new_blocks);
+    return next_block;
+}
 
-        std::swap(prev_equiv, next_equiv);
-    } while (changed);
+void
+SignatureRefinement::refine()
+{
+    // The initial blocks are numbered densely, so we can tell when a round
+    // doesn't split anything just by counting blocks.
+    std::size_t block_count = 0;
+    for (Block block : block_of_) {
+        block_count = std::max(block_count, std::size_t(block) + 1);
+    }
+    while (true) {
+        State size = graph_.size();
+        State chunk = (size + threads_ - 1) / threads_;
+        std::vector<std::thread> workers;
+        for (State begin = chunk; begin < size; begin += chunk) {
+            workers.emplace_back(&SignatureRefinement::hash_signatures, this,
+                                 begin, std::min(begin + chunk, size));
+        }
+        hash_signatures(0, std::min(chunk, size));
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+
+        std::size_t new_block_count = renumber();
+        if (new_block_count == block_count) {
+            return;
+        }
+        block_count = new_block_count;
+    }
+}
+
+// The quotient automaton of a prenormalized graph, once we've merged together
+// all of the bisimilar states.  Each equivalence class gets a dense ID; the
+// class containing the root is always class 0.  For each class, we store the
+// members, and the class that each outgoing event leads to, sorted by event.
+// We also store the Normalization process for each class, so that following a
+// transition is just a table lookup.
+class Quotient {
+  public:
+    using Class = std::uint32_t;
+
+    Quotient(const FlatGraph& graph, const std::vector<std::uint32_t>& blocks);
+
+    Class size() const { return members_.size(); }
+
+    const std::vector<const NormalizedProcess*>& members(Class c) const
+    {
+        return members_[c];
+    }
+
+    // Calls `op` for each event that the members of class `c` can perform.
+    void initials(Class c, function_ref<void(Event)> op) const
+    {
+        for (std::uint32_t i = begin_[c]; i < begin_[c + 1]; i++) {
+            op(events_[i]);
+        }
+    }
 
-    return std::unique_ptr<Equivalences>(
-            new Equivalences(std::move(next_equiv)));
+    // Returns the normalized process for the class that you reach by following
+    // `initial` from class `c`, or nullptr if there isn't one.
+    const NormalizedProcess* after(Class c, Event initial) const
+    {
+        auto first = events_.begin() + begin_[c];
+        auto last = events_.begin() + begin_[c + 1];
+        auto it = std::lower_bound(first, last, initial);
+        if (it == last || *it != initial) {
+            return nullptr;
+        }
+        return nodes[targets_[it - events_.begin()]];
+    }
+
+    // The normalized process for each class.  Environment::normalize fills
+    // these in once it has registered them.
+    std::vector<const NormalizedProcess*> nodes;
+
+  private:
+    std::vector<std::vector<const NormalizedProcess*>> members_;
+    std::vector<std::uint32_t> begin_;
+    std::vector<Event> events_;
+    std::vector<Class> targets_;
+};
+
+Quotient::Quotient(const FlatGraph& graph,
+                   const std::vector<std::uint32_t>& blocks)
+{
+    // Number the classes in the order that we encounter their first members.
+    // States are numbered in breadth-first order, so the root's class is 0.
+    std::unordered_map<std::uint32_t, Class> classes;
+    std::vector<Class> class_of(graph.size());
+    for (FlatGraph::State state = 0; state < graph.size(); state++) {
+        auto result = classes.emplace(blocks[state], classes.size());
+        Class c = result.first->second;
+        if (result.second) {
+            members_.emplace_back();
+        }
+        class_of[state] = c;
+        members_[c].push_back(graph.process(state));
+    }
+
+    // A class can perform an event if any of its members can, and the members
+    // must all lead to the same class, since they're bisimilar.
+    std::vector<std::vector<std::pair<Event, Class>>> rows(members_.size());
+    for (FlatGraph::State state = 0; state < graph.size(); state++) {
+        std::vector<std::pair<Event, Class>>& row = rows[class_of[state]];
+        graph.transitions(state, [&row, &class_of](Event event,
+                                                   FlatGraph::State target) {
+            row.emplace_back(event, class_of[target]);
+        });
+    }
+    begin_.reserve(rows.size() + 1);
+    for (std::vector<std::pair<Event, Class>>& row : rows) {
+        std::sort(row.begin(), row.end());
+        row.erase(std::unique(row.begin(), row.end()), row.end());
+        begin_.push_back(events_.size());
+        for (const auto& transition : row) {
+            assert(events_.size() == begin_.back() ||
+                   events_.back() != transition.first);
+            events_.push_back(transition.first);
+            targets_.push_back(transition.second);
+        }
+    }
+    begin_.push_back(events_.size());
+}
+
+template <typename Model>
+std::unique_ptr<Quotient>
+bisimulate(const NormalizedProcess* root, unsigned int threads)
+{
+    FlatGraph graph(root);
+
+    // Start with each block containing all of the states with a particular
+    // behavior.
+    std::vector<std::uint32_t> blocks;
+    blocks.reserve(graph.size());
+    std::unordered_map<typename Model::Behavior, std::uint32_t> behaviors;
+    for (FlatGraph::State state = 0; state < graph.size(); state++) {
+        auto behavior = Model::get_process_behavior(*graph.process(state));
+        auto result = behaviors.emplace(std::move(behavior), behaviors.size());
+        blocks.push_back(result.first->second);
+    }
+
+    if (threads <= 1) {
+        PartitionRefinement refinement(graph, std::move(blocks));
+        refinement.refine();
+        return std::unique_ptr<Quotient>(
+                new Quotient(graph, refinement.blocks()));
+    } else {
+        SignatureRefinement refinement(graph, std::move(blocks), threads);
+        refinement.refine();
+        return std::unique_ptr<Quotient>(
+                new Quotient(graph, refinement.blocks()));
+    }
 }
 
 template <typename Model>
 class Normalization : public NormalizedProcess {
   public:
-    Normalization(Environment* env, const NormalizedProcess* prenormalized_root,
-                  std::unique_ptr<Equivalences> equivalences,
-                  Equivalences::Head equivalence_class)
-        : env_(env),
-          prenormalized_root_(prenormalized_root),
-          equivalences_(equivalences.get()),
-          equivalence_class_(equivalence_class),
-          equivalences_owned_(std::move(equivalences))
+    // Creates the normalized process for class 0 (the root) of `quotient`,
+    // which it takes ownership of.
+    Normalization(const NormalizedProcess* prenormalized_root,
+                  std::unique_ptr<Quotient> quotient)
+        : prenormalized_root_(prenormalized_root),
+          quotient_(quotient.get()),
+          equivalence_class_(0),
+          quotient_owned_(std::move(quotient))
     {
-        assert(equivalence_class);
     }
 
-    void initials(std::function<void(Event)> op) const override;
+    void initials(function_ref<void(Event)> op) const override;
     const NormalizedProcess* after(Event initial) const override;
-    void subprocesses(std::function<void(const Process&)> op) const override;
-    void expand(std::function<void(const Process&)> op) const override;
+    void subprocesses(function_ref<void(const Process&)> op) const override;
+    void expand(function_ref<void(const Process&)> op) const override;
 
-    std::size_t hash() const override;
+    std::size_t compute_hash() const override;
     bool operator==(const Process& other) const override;
     unsigned int precedence() const override { return 0; }
     void print(std::ostream& out) const override;
@@ -196,27 +580,25 @@ class Normalization : public NormalizedProcess {
     const NormalizedProcess* find_subprocess(Process::Set processes) const;
 
   private:
-    Normalization(Environment* env, const NormalizedProcess* prenormalized_root,
-                  Equivalences* equivalences,
-                  Equivalences::Head equivalence_class)
-        : env_(env),
-          prenormalized_root_(prenormalized_root),
-          equivalences_(equivalences),
+    friend class hst::Environment;
+
+    Normalization(const NormalizedProcess* prenormalized_root,
+                  Quotient* quotient, Quotient::Class equivalence_class)
+        : prenormalized_root_(prenormalized_root),
+          quotient_(quotient),
           equivalence_class_(equivalence_class)
     {
-        assert(equivalence_class);
     }
 
-    const Equivalences::MemberSet& members() const
+    const std::vector<const NormalizedProcess*>& members() const
     {
-        return equivalences_->get_members(equivalence_class_);
+        return quotient_->members(equivalence_class_);
     }
 
-    Environment* env_;
     const NormalizedProcess* prenormalized_root_;
-    Equivalences* equivalences_;
-    Equivalences::Head equivalence_class_;
-    std::unique_ptr<Equivalences> equivalences_owned_;
+    Quotient* quotient_;
+    Quotient::Class equivalence_class_;
+    std::unique_ptr<Quotient> quotient_owned_;
 };
 
 }  // namespace
@@ -225,11 +607,31 @@ template <typename Model>
 const NormalizedProcess*
 Environment::normalize(const NormalizedProcess* root)
 {
-    std::unique_ptr<Equivalences> equivalences = bisimulate<Model>(root);
-    Equivalences::Head equivalence_class = equivalences->get_class(root);
-    assert(equivalence_class);
-    return register_process(new Normalization<Model>(
-            this, root, std::move(equivalences), equivalence_class));
+    return normalize<Model>(root, 1);
+}
+
+template <typename Model>
+const NormalizedProcess*
+Environment::normalize(const NormalizedProcess* root, unsigned int threads)
+{
+    const Normalization<Model>* normalized =
+            register_process<Normalization<Model>>(
+                    root, bisimulate<Model>(root, threads));
+
+    // If we've normalized this root before, the registry will have given us
+    // back the existing normalized root, along with its quotient.  Otherwise,
+    // register the normalized process for each of the other equivalence
+    // classes up front, so that Normalization::after never has to.
+    Quotient* quotient = normalized->quotient_;
+    if (quotient->nodes.empty()) {
+        quotient->nodes.reserve(quotient->size());
+        quotient->nodes.push_back(normalized);
+        for (Quotient::Class c = 1; c < quotient->size(); c++) {
+            quotient->nodes.push_back(register_process<Normalization<Model>>(
+                    root, quotient, c));
+        }
+    }
+    return normalized;
 }
 
 template <typename Model>
@@ -237,24 +639,20 @@ const NormalizedProcess*
 Normalization<Model>::find_subprocess(Process::Set processes) const
 {
     // Find the equivalence class that `processes` belong to.
-    for (const auto& head_and_members : equivalences_->get_classes()) {
-        Equivalences::Head head = head_and_members.first;
-        const auto& members = head_and_members.second;
+    for (Quotient::Class c = 0; c < quotient_->size(); c++) {
         Process::Set expanded_members;
-        for (const NormalizedProcess* member : members) {
+        for (const NormalizedProcess* member : quotient_->members(c)) {
             member->expand([&expanded_members](const Process& process) {
                 expanded_members.insert(&process);
             });
         }
         if (processes == expanded_members) {
             // We've found the right equivalence class!
-            return env_->register_process(new Normalization<Model>(
-                    env_, prenormalized_root_, equivalences_, head));
+            return quotient_->nodes[c];
         }
     }
     assert(false);
     return nullptr;
-
 }
 
 template <typename Model>
@@ -269,59 +667,53 @@ Environment::normalize(const NormalizedProcess* root, Process::Set processes)
 template const NormalizedProcess*
 Environment::normalize<Traces>(const NormalizedProcess* root);
 
+template const NormalizedProcess*
+Environment::normalize<Traces>(const NormalizedProcess* root,
+                               unsigned int threads);
+
 template const NormalizedProcess*
 Environment::normalize<Traces>(const NormalizedProcess* root,
                                Process::Set processes);
 
+template const NormalizedProcess*
+Environment::normalize<Failures>(const NormalizedProcess* root);
+
+template const NormalizedProcess*
+Environment::normalize<Failures>(const NormalizedProcess* root,
+                                 unsigned int threads);
+
+template const NormalizedProcess*
+Environment::normalize<Failures>(const NormalizedProcess* root,
+                                 Process::Set processes);
+
+template const NormalizedProcess*
+Environment::normalize<FailuresDivergences>(const NormalizedProcess* root);
+
+template const NormalizedProcess*
+Environment::normalize<FailuresDivergences>(const NormalizedProcess* root,
+                                            unsigned int threads);
+
+template const NormalizedProcess*
+Environment::normalize<FailuresDivergences>(const NormalizedProcess* root,
+                                            Process::Set processes);
+
 template <typename Model>
 void
-Normalization<Model>::initials(std::function<void(Event)> op) const
+Normalization<Model>::initials(function_ref<void(Event)> op) const
 {
-    for (const NormalizedProcess* process : members()) {
-        process->initials(op);
-    }
+    quotient_->initials(equivalence_class_, op);
 }
 
 template <typename Model>
 const NormalizedProcess*
 Normalization<Model>::after(Event initial) const
 {
-    // Find the set of processes that you could end up in by starting in one of
-    // our underlying processes and following a single `initial` event.
-    std::unordered_set<const NormalizedProcess*> afters;
-    for (const NormalizedProcess* process : members()) {
-        const NormalizedProcess* after = process->after(initial);
-        if (after) {
-            afters.insert(after);
-        }
-    }
-
-    // If none of the processes can perform this event, neither can we.
-    if (afters.empty()) {
-        return nullptr;
-    }
-
-    // Because we've already prenormalized the underlying processes and merged
-    // equivalent processes via bisimulation, all of the `afters` that we just
-    // found should all belong to the same equivalence class.
-    Equivalences::Head after_head = nullptr;
-    for (const NormalizedProcess* after : afters) {
-        Equivalences::Head curr_head = equivalences_->get_class(after);
-        assert(!after_head || after_head == curr_head);
-        if (!after_head) {
-            after_head = curr_head;
-        }
-    }
-
-    // Our "real" after is the normalized node for this equivalence class that
-    // we just found.
-    return env_->register_process(new Normalization<Model>(
-            env_, prenormalized_root_, equivalences_, after_head));
+    return quotient_->after(equivalence_class_, initial);
 }
 
 template <typename Model>
 void
-Normalization<Model>::subprocesses(std::function<void(const Process&)> op) const
+Normalization<Model>::subprocesses(function_ref<void(const Process&)> op) const
 {
     for (const NormalizedProcess* process : members()) {
         op(*process);
@@ -330,7 +722,7 @@ Normalization<Model>::subprocesses(std::function<void(const Process&)> op) const
 
 template <typename Model>
 void
-Normalization<Model>::expand(std::function<void(const Process&)> op) const
+Normalization<Model>::expand(function_ref<void(const Process&)> op) const
 {
     for (const NormalizedProcess* process : members()) {
         process->expand(op);
@@ -339,7 +731,7 @@ Normalization<Model>::expand(std::function<void(const Process&)> op) const
 
 template <typename Model>
 std::size_t
-Normalization<Model>::hash() const
+Normalization<Model>::compute_hash() const
 {
     static hash_scope normalized;
     return hasher(normalized)
@@ -7,11 +7,11 @@
 
 #include "hst/environment.h"
 
-#include <functional>
 #include <memory>
 #include <ostream>
 
 #include "hst/event.h"
+#include "hst/function-ref.h"
 #include "hst/hash.h"
 #include "hst/process.h"
 
@@ -22,12 +22,12 @@ namespace {
 class Prefix : public Process {
   public:
     Prefix(Event a, const Process* p) : a_(a), p_(p) {}
-    void initials(std::function<void(Event)> op) const override;
+    void initials(function_ref<void(Event)> op) const override;
     void afters(Event initial,
-                std::function<void(const Process&)> op) const override;
-    void subprocesses(std::function<void(const Process&)> op) const override;
+                function_ref<void(const Process&)> op) const override;
+    void subprocesses(function_ref<void(const Process&)> op) const override;
 
-    std::size_t hash() const override;
+    std::size_t compute_hash() const override;
     bool operator==(const Process& other) const override;
     unsigned int precedence() const override { return 1; }
     void print(std::ostream& out) const override;
@@ -42,7 +42,7 @@ class Prefix : public Process {
 const Process*
 Environment::prefix(Event a, const Process* p)
 {
-    return register_process(new Prefix(a, p));
+    return register_process<Prefix>(a, p);
 }
 
 // Operational semantics for a → P
@@ -51,14 +51,14 @@ Environment::prefix(Event a, const Process* p)
 //     a → P -a→ P
 
 void
-Prefix::initials(std::function<void(Event)> op) const
+Prefix::initials(function_ref<void(Event)> op) const
 {
     // initials(a → P) = {a}
     op(a_);
 }
 
 void
-Prefix::afters(Event initial, std::function<void(const Process&)> op) const
+Prefix::afters(Event initial, function_ref<void(const Process&)> op) const
 {
     // afters(a → P, a) = P
     if (initial == a_) {
@@ -67,13 +67,13 @@ Prefix::afters(Event initial, std::function<void(const Process&)> op) const
 }
 
 void
-Prefix::subprocesses(std::function<void(const Process&)> op) const
+Prefix::subprocesses(function_ref<void(const Process&)> op) const
 {
     op(*p_);
 }
 
 std::size_t
-Prefix::hash() const
+Prefix::compute_hash() const
 {
     static hash_scope prefix;
     return hasher(prefix).add(a_).add(*p_).value();
@@ -86,7 +86,7 @@ Prefix::operator==(const Process& other_) const
     if (other == nullptr) {
         return false;
     }
-    return a_ == other->a_ && *p_ == *other->p_;
+    return a_ == other->a_ && p_ == other->p_;
 }
 
 void
@@ -7,13 +7,16 @@
 
 #include "hst/environment.h"
 
-#include <functional>
+#include <algorithm>
 #include <memory>
 #include <ostream>
+#include <vector>
 
 #include "hst/event.h"
+#include "hst/function-ref.h"
 #include "hst/hash.h"
 #include "hst/process.h"
+#include "hst/subset-table.h"
 
 namespace hst {
 
@@ -21,47 +24,71 @@ namespace {
 
 class Prenormalization : public NormalizedProcess {
   public:
-    Prenormalization(Environment* env, Process::Set ps) : env_(env), ps_(ps)
+    // `subset` must be τ-closed.
+    Prenormalization(Environment* env, SubsetTable::ID subset)
+        : env_(env), subset_(subset)
     {
-        ps_.tau_close();
     }
 
-    void initials(std::function<void(Event)> op) const override;
+    void initials(function_ref<void(Event)> op) const override;
     const NormalizedProcess* after(Event initial) const override;
-    void subprocesses(std::function<void(const Process&)> op) const override;
-    void expand(std::function<void(const Process&)> op) const override;
+    void subprocesses(function_ref<void(const Process&)> op) const override;
+    void expand(function_ref<void(const Process&)> op) const override;
 
-    std::size_t hash() const override;
+    std::size_t compute_hash() const override;
     bool operator==(const Process& other) const override;
     unsigned int precedence() const override { return 0; }
     void print(std::ostream& out) const override;
 
   private:
+    SubsetTable::Members members() const
+    {
+        return env_->subsets().members(subset_);
+    }
+
     Environment* env_;
-    Process::Set ps_;  // constructor ensures this is τ-closed
+    SubsetTable::ID subset_;
 };
 
+// Returns the prenormalized process for the τ-closure of `processes`.
+const NormalizedProcess*
+prenormalize_closure(Environment* env,
+                     const std::vector<const Process*>& processes)
+{
+    std::vector<Process::Index> indices;
+    for (const Process* process : processes) {
+        for (const Process* member : env->tau_closure(*process)) {
+            indices.push_back(member->index());
+        }
+    }
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    SubsetTable::ID subset = env->subsets().intern(indices);
+    return env->register_process<Prenormalization>(env, subset);
+}
+
 }  // namespace
 
 const NormalizedProcess*
 Environment::prenormalize(Process::Set ps)
 {
-    return register_process(new Prenormalization(this, std::move(ps)));
+    return prenormalize_closure(
+            this, std::vector<const Process*>(ps.begin(), ps.end()));
 }
 
 const NormalizedProcess*
 Environment::prenormalize(const Process* p)
 {
-    return prenormalize(Process::Set{p});
+    return prenormalize_closure(this, std::vector<const Process*>{p});
 }
 
 void
-Prenormalization::initials(std::function<void(Event)> op) const
+Prenormalization::initials(function_ref<void(Event)> op) const
 {
     // Find all of the non-τ events that any of the underlying processes can
     // perform.
-    for (const Process* p : ps_) {
-        p->initials([&op](Event initial) {
+    for (Process::Index index : members()) {
+        env_->process(index)->initials([&op](Event initial) {
             if (initial != Event::tau()) {
                 op(initial);
             }
@@ -79,39 +106,40 @@ Prenormalization::after(Event initial) const
 
     // Find the set of processes that you could end up in by starting in one of
     // our underlying processes and following a single `initial` event.
-    Process::Set afters;
-    for (const Process* p : ps_) {
-        p->afters(initial, [&afters](const Process& process) {
-            afters.insert(&process);
-        });
+    std::vector<const Process*> afters;
+    for (Process::Index index : members()) {
+        env_->process(index)->transitions(
+                initial, [&afters](const Process& process) {
+                    afters.push_back(&process);
+                });
     }
 
     // Since a normalized process can only have one `after` for any event, merge
     // together all of the possible afters into a single prenormalized process.
-    return env_->prenormalize(std::move(afters));
+    return prenormalize_closure(env_, afters);
 }
 
 void
-Prenormalization::subprocesses(std::function<void(const Process&)> op) const
+Prenormalization::subprocesses(function_ref<void(const Process&)> op) const
 {
-    for (const Process* process : ps_) {
-        op(*process);
+    for (Process::Index index : members()) {
+        op(*env_->process(index));
     }
 }
 
 void
-Prenormalization::expand(std::function<void(const Process&)> op) const
+Prenormalization::expand(function_ref<void(const Process&)> op) const
 {
-    for (const Process* process : ps_) {
-        op(*process);
+    for (Process::Index index : members()) {
+        op(*env_->process(index));
     }
 }
 
 std::size_t
-Prenormalization::hash() const
+Prenormalization::compute_hash() const
 {
     static hash_scope prenormalized;
-    return hasher(prenormalized).add(ps_).value();
+    return hasher(prenormalized).add(subset_).value();
 }
 
 bool
@@ -122,13 +150,17 @@ Prenormalization::operator==(const Process& other_) const
     if (other == nullptr) {
         return false;
     }
-    return ps_ == other->ps_;
+    return subset_ == other->subset_;
 }
 
 void
 Prenormalization::print(std::ostream& out) const
 {
-    out << "prenormalize " << ps_;
+    Process::Set ps;
+    for (Process::Index index : members()) {
+        ps.insert(env_->process(index));
+    }
+    out << "prenormalize " << ps;
 }
 
 }  // namespace hst
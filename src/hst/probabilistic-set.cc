@@ -0,0 +1,150 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "hst/probabilistic-set.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace hst {
+
+namespace {
+
+// The MurmurHash3 finalizer.  Our keys are typically packed indices, which are
+// nowhere near uniformly distributed, so we need to mix them thoroughly before
+// using any of their bits.
+std::uint64_t
+mix(std::uint64_t x)
+{
+    x ^= x >> 33;
+    x *= UINT64_C(0xff51afd7ed558ccd);
+    x ^= x >> 33;
+    x *= UINT64_C(0xc4ceb9fe1a85ec53);
+    x ^= x >> 33;
+    return x;
+}
+
+}  // namespace
+
+double
+ProbabilisticSet::omission_probability() const
+{
+    if (definitely_omitted_) {
+        return 1;
+    }
+    // Treat each omission as an independent rare event.
+    return -std::expm1(-expected_omissions_);
+}
+
+//------------------------------------------------------------------------------
+// Bitstate
+
+BitstateSet::BitstateSet(unsigned int log2_bits, unsigned int hash_count)
+    : words_(log2_bits <= 6 ? 1 : std::size_t(1) << (log2_bits - 6), 0),
+      mask_((std::uint64_t(1) << log2_bits) - 1),
+      hash_count_(hash_count)
+{
+}
+
+bool
+BitstateSet::insert(std::uint64_t key)
+{
+    // We use double hashing to derive all of the key's bit positions from two
+    // independent hashes.  The stride is odd, so the positions don't repeat
+    // until we've wrapped all the way around the array.
+    std::uint64_t hash = mix(key);
+    std::uint64_t stride = mix(key ^ UINT64_C(0x9e3779b97f4a7c15)) | 1;
+    double fill = double(set_bits_) / double(mask_ + 1);
+    bool is_new = false;
+    for (unsigned int i = 0; i < hash_count_; i++) {
+        std::uint64_t bit = (hash + i * stride) & mask_;
+        std::uint64_t& word = words_[bit >> 6];
+        std::uint64_t flag = std::uint64_t(1) << (bit & 63);
+        if (!(word & flag)) {
+            word |= flag;
+            set_bits_++;
+            is_new = true;
+        }
+    }
+    if (is_new) {
+        // A new key is omitted if all of its bits happen to be set already.
+        added(std::pow(fill, hash_count_));
+    }
+    return is_new;
+}
+
+//------------------------------------------------------------------------------
+// Hash compaction
+
+HashCompactionSet::HashCompactionSet(unsigned int log2_slots,
+                                     unsigned int fingerprint_bits)
+    : mask_((std::size_t(1) << log2_slots) - 1),
+      // Linear probing slows to a crawl as the table fills up, so we stop
+      // storing fingerprints once it's 15/16 full.
+      max_size_((mask_ + 1) - (mask_ + 1) / 16),
+      fingerprint_bits_(fingerprint_bits),
+      slot_bytes_((fingerprint_bits + 7) / 8)
+{
+    bytes_.assign((mask_ + 1) * slot_bytes_, 0);
+}
+
+std::uint64_t
+HashCompactionSet::load(std::size_t slot) const
+{
+    // Fingerprints are stored little-endian, using only as many bytes as the
+    // fingerprint width needs.
+    const unsigned char* bytes = &bytes_[slot * slot_bytes_];
+    std::uint64_t fingerprint = 0;
+    for (unsigned int i = 0; i < slot_bytes_; i++) {
+        fingerprint |= std::uint64_t(bytes[i]) << (8 * i);
+    }
+    return fingerprint;
+}
+
+void
+HashCompactionSet::store(std::size_t slot, std::uint64_t fingerprint)
+{
+    unsigned char* bytes = &bytes_[slot * slot_bytes_];
+    for (unsigned int i = 0; i < slot_bytes_; i++) {
+        bytes[i] = static_cast<unsigned char>(fingerprint >> (8 * i));
+    }
+}
+
+bool
+HashCompactionSet::insert(std::uint64_t key)
+{
+    // The fingerprint and the starting slot come from independent hashes of
+    // the key.  We reserve 0 to mark empty slots, so there are
+    // 2^`fingerprint_bits`-1 fingerprints.
+    std::uint64_t fingerprint = mix(key) >> (64 - fingerprint_bits_);
+    if (fingerprint == 0) {
+        fingerprint = 1;
+    }
+    std::size_t i = mix(key ^ UINT64_C(0x9e3779b97f4a7c15)) & mask_;
+    for (;; i = (i + 1) & mask_) {
+        std::uint64_t slot = load(i);
+        if (slot == fingerprint) {
+            return false;
+        }
+        if (slot == 0) {
+            break;
+        }
+    }
+    if (size() >= max_size_) {
+        omitted();
+        return false;
+    }
+    store(i, fingerprint);
+    // A new key is omitted if its fingerprint matches any of the existing ones.
+    double fingerprints = std::ldexp(1.0, fingerprint_bits_) - 1;
+    added(double(size()) / fingerprints);
+    return true;
+}
+
+}  // namespace hst
@@ -0,0 +1,117 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef HST_PROBABILISTIC_SET_H
+#define HST_PROBABILISTIC_SET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace hst {
+
+// A set of 64-bit keys that uses much less memory than an exact set, at the
+// cost of sometimes claiming that it already contains a key that was never
+// added.  If you use one of these as the visited set of a search, that means
+// the search might silently skip (or "omit") some states, so we keep a running
+// estimate of how likely that is.
+class ProbabilisticSet {
+  public:
+    virtual ~ProbabilisticSet() = default;
+
+    // Adds `key` to the set, returning whether it (probably) wasn't already
+    // there.
+    virtual bool insert(std::uint64_t key) = 0;
+
+    // The number of keys that we've added to the set.
+    std::size_t size() const { return size_; }
+
+    // The expected number of distinct keys that we wrongly claimed were
+    // already in the set.  For each key that we add, we add the probability
+    // that a new key would have collided with the keys already in the set at
+    // that point.
+    double expected_omissions() const { return expected_omissions_; }
+
+    // The probability that we wrongly claimed that at least one distinct key
+    // was already in the set.
+    double omission_probability() const;
+
+  protected:
+    // Records that we've added a new key, which would have been omitted with
+    // probability `collision_probability`.
+    void added(double collision_probability)
+    {
+        size_++;
+        expected_omissions_ += collision_probability;
+    }
+
+    // Records that we've definitely omitted a key, because we had no room to
+    // store it.
+    void omitted()
+    {
+        expected_omissions_ += 1;
+        definitely_omitted_ = true;
+    }
+
+  private:
+    std::size_t size_ = 0;
+    double expected_omissions_ = 0;
+    bool definitely_omitted_ = false;
+};
+
+// A "supertrace" set, which stores a fixed-size array of bits.  We set
+// `hash_count` of those bits for each key that we add, and assume that a key is
+// already in the set if all of its bits are already set.  This never uses any
+// more memory than the bit array itself, no matter how many keys you add, but
+// the omission probability climbs quickly once the array starts to fill up.
+class BitstateSet : public ProbabilisticSet {
+  public:
+    // The bit array contains 2^`log2_bits` bits.
+    BitstateSet(unsigned int log2_bits, unsigned int hash_count);
+
+    bool insert(std::uint64_t key) override;
+
+  private:
+    std::vector<std::uint64_t> words_;
+    std::uint64_t mask_;
+    unsigned int hash_count_;
+    std::uint64_t set_bits_ = 0;
+};
+
+// A hash compaction set, which stores a fingerprint of each key in a fixed-size
+// open-addressing table, and assumes that a key is already in the set if its
+// fingerprint is.  You choose the width of the fingerprints, which is a
+// tradeoff between memory and the omission probability: each slot takes up
+// `fingerprint_bits / 8` bytes (rounded up), and a new key is omitted with
+// probability of about n / 2^`fingerprint_bits` when the set contains n keys.
+//
+// The table is allocated up front and never grows, so the set uses a fixed,
+// predictable amount of memory.  Once the table is almost full, we can't store
+// any more fingerprints, so we treat every new key as if it were already in
+// the set; the omission probability reflects that.
+class HashCompactionSet : public ProbabilisticSet {
+  public:
+    // The table contains 2^`log2_slots` slots.  `fingerprint_bits` must be
+    // between 8 and 64.
+    explicit HashCompactionSet(unsigned int log2_slots,
+                               unsigned int fingerprint_bits = 64);
+
+    bool insert(std::uint64_t key) override;
+
+  private:
+    std::uint64_t load(std::size_t slot) const;
+    void store(std::size_t slot, std::uint64_t fingerprint);
+
+    std::vector<unsigned char> bytes_;
+    std::size_t mask_;
+    std::size_t max_size_;
+    unsigned int fingerprint_bits_;
+    unsigned int slot_bytes_;
+};
+
+}  // namespace hst
+#endif  // HST_PROBABILISTIC_SET_H
@@ -8,14 +8,59 @@
 #include "hst/process.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include "hst/environment.h"
 #include "hst/hash.h"
+#include "hst/transition-cache.h"
 
 namespace hst {
 
+void
+Process::transitions(function_ref<void(Event, const Process&)> op) const
+{
+    TransitionCache* cache = environment_->transition_cache();
+    if (cache) {
+        cache->transitions(*this, op);
+        return;
+    }
+
+    Event::Set initials;
+    this->initials(&initials);
+    for (Event initial : initials) {
+        afters(initial,
+               [&op, initial](const Process& after) { op(initial, after); });
+    }
+}
+
+void
+Process::transitions(Event initial, function_ref<void(const Process&)> op) const
+{
+    TransitionCache* cache = environment_->transition_cache();
+    if (cache) {
+        cache->afters(*this, initial, op);
+        return;
+    }
+    afters(initial, op);
+}
+
+void
+Process::cached_initials(Event::Set* out) const
+{
+    TransitionCache* cache = environment_->transition_cache();
+    if (cache) {
+        cache->initials(*this, out);
+        return;
+    }
+    initials(out);
+}
+
 void
 Process::initials(Event::Set* out) const
 {
@@ -36,7 +81,7 @@ Process::subprocesses(Process::Set* out) const
 
 void
 NormalizedProcess::afters(Event initial,
-                          std::function<void(const Process&)> op) const
+                          function_ref<void(const Process&)> op) const
 {
     const NormalizedProcess* process = after(initial);
     if (process) {
@@ -44,17 +89,162 @@ NormalizedProcess::afters(Event initial,
     }
 }
 
+namespace {
+
+// A set of process indices that can be updated from several threads at once.
+// Like Process::IndexSet, this is a bitmap, but we can't resize it while other
+// threads are using it, so the bitmap is split into chunks, which we allocate
+// (atomically) the first time that they're needed.
+class ConcurrentIndexSet {
+  public:
+    ConcurrentIndexSet() : chunks_(new std::atomic<Word*>[chunk_count])
+    {
+        for (std::size_t i = 0; i < chunk_count; i++) {
+            chunks_[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~ConcurrentIndexSet()
+    {
+        for (std::size_t i = 0; i < chunk_count; i++) {
+            delete[] chunks_[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    // Adds `index` to the set, returning whether it wasn't already there.
+    bool insert(Process::Index index)
+    {
+        Word* words = chunk(index >> chunk_bits);
+        std::size_t bit = index & (chunk_size - 1);
+        std::uint64_t mask = std::uint64_t(1) << (bit % 64);
+        return !(words[bit / 64].fetch_or(mask) & mask);
+    }
+
+  private:
+    using Word = std::atomic<std::uint64_t>;
+    static const std::size_t chunk_bits = 20;
+    static const std::size_t chunk_size = std::size_t(1) << chunk_bits;
+    static const std::size_t chunk_count =
+            ((std::size_t(1) << (8 * sizeof(Process::Index))) >> chunk_bits);
+
+    Word* chunk(std::size_t chunk_index)
+    {
+        Word* words = chunks_[chunk_index].load(std::memory_order_acquire);
+        if (words) {
+            return words;
+        }
+        Word* fresh = new Word[chunk_size / 64];
+        for (std::size_t i = 0; i < chunk_size / 64; i++) {
+            fresh[i].store(0, std::memory_order_relaxed);
+        }
+        if (chunks_[chunk_index].compare_exchange_strong(
+                    words, fresh, std::memory_order_acq_rel)) {
+            return fresh;
+        }
+        // Another thread allocated this chunk first; use theirs.
+        delete[] fresh;
+        return words;
+    }
+
+    std::unique_ptr<std::atomic<Word*>[]> chunks_;
+};
+
+// Adds each unvisited successor of `process` to `next_queue`.
+void
+expand_concurrently(const Process& process, ConcurrentIndexSet* seen,
+                    std::vector<const Process*>* next_queue)
+{
+    // parallel_bfs only calls this when the environment isn't caching
+    // transitions, so we use initials and afters directly.
+    process.initials([&process, seen, next_queue](Event initial) {
+        process.afters(initial, [seen, next_queue](const Process& after) {
+            if (seen->insert(after.index())) {
+                next_queue->push_back(&after);
+            }
+        });
+    });
+}
+
+}  // namespace
+
+void
+Process::parallel_bfs(unsigned int threads,
+                      function_ref<void(const Process&)> op) const
+{
+    // The transition cache can't be filled in from several threads at once,
+    // and even if we avoided it here, nested operators (like prenormalized
+    // processes) would still go through it.  So a cached environment always
+    // gets a sequential search.
+    if (threads <= 1 || environment_->transition_cache()) {
+        bfs(op);
+        return;
+    }
+
+    // Levels that are smaller than this aren't worth starting up threads for;
+    // we expand them on the calling thread.
+    const std::size_t min_parallel_level = 64 * threads;
+    // Each worker grabs this many processes from the current level at a time.
+    const std::size_t batch_size = 16;
+
+    ConcurrentIndexSet seen;
+    std::vector<const Process*> queue;
+    std::vector<std::vector<const Process*>> next_queues(threads);
+    seen.insert(index());
+    queue.push_back(this);
+    while (!queue.empty()) {
+        for (const Process* process : queue) {
+            op(*process);
+        }
+
+        if (queue.size() < min_parallel_level) {
+            for (const Process* process : queue) {
+                expand_concurrently(*process, &seen, &next_queues[0]);
+            }
+        } else {
+            std::atomic<std::size_t> next(0);
+            auto worker = [&queue, &seen, &next,
+                           batch_size](std::vector<const Process*>* out) {
+                while (true) {
+                    std::size_t begin = next.fetch_add(batch_size);
+                    if (begin >= queue.size()) {
+                        return;
+                    }
+                    std::size_t end =
+                            std::min(begin + batch_size, queue.size());
+                    for (std::size_t i = begin; i < end; i++) {
+                        expand_concurrently(*queue[i], &seen, out);
+                    }
+                }
+            };
+            std::vector<std::thread> workers;
+            for (unsigned int i = 1; i < threads; i++) {
+                workers.emplace_back(worker, &next_queues[i]);
+            }
+            worker(&next_queues[0]);
+            for (std::thread& thread : workers) {
+                thread.join();
+            }
+        }
+
+        queue.clear();
+        for (std::vector<const Process*>& next_queue : next_queues) {
+            queue.insert(queue.end(), next_queue.begin(), next_queue.end());
+            next_queue.clear();
+        }
+    }
+}
+
 std::size_t
 Process::Bag::hash() const
 {
+    // Each member's hash is cached, so this is linear in the size of the bag,
+    // and doesn't depend on how deep each member is.
     static hash_scope scope;
-    hst::hasher hash(scope);
-    std::vector<const Process*> sorted(begin(), end());
-    std::sort(sorted.begin(), sorted.end());
-    for (const Process* process : sorted) {
-        hash.add(*process);
+    unordered_hasher members;
+    for (const Process* process : *this) {
+        members.add(*process);
     }
-    return hash.value();
+    return hst::hasher(scope).add(size()).add(members.value()).value();
 }
 
 std::ostream& operator<<(std::ostream& out, const Process::Bag& processes)
@@ -85,31 +275,26 @@ std::ostream& operator<<(std::ostream& out, const Process::Bag& processes)
 std::size_t
 Process::Set::hash() const
 {
+    // Each member's hash is cached, so this is linear in the size of the set,
+    // and doesn't depend on how deep each member is.
     static hash_scope scope;
-    hst::hasher hash(scope);
-    std::vector<const Process*> sorted(begin(), end());
-    std::sort(sorted.begin(), sorted.end());
-    for (const Process* process : sorted) {
-        hash.add(*process);
+    unordered_hasher members;
+    for (const Process* process : *this) {
+        members.add(*process);
     }
-    return hash.value();
+    return hst::hasher(scope).add(size()).add(members.value()).value();
 }
 
 void
 Process::Set::tau_close()
 {
-    Event tau = Event::tau();
-    while (true) {
-        Process::Set new_processes;
-        for (const Process* process : *this) {
-            process->afters(tau, &new_processes);
-        }
-        size_type old_size = size();
-        insert(new_processes.begin(), new_processes.end());
-        size_type new_size = size();
-        if (old_size == new_size) {
-            return;
-        }
+    // The environment remembers the τ-closure of each individual process, so
+    // we just have to union together the closures of our members.
+    std::vector<const Process*> members(begin(), end());
+    for (const Process* process : members) {
+        const Process::Set& closure =
+                process->environment_->tau_closure(*process);
+        insert(closure.begin(), closure.end());
     }
 }
 
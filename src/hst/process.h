@@ -18,41 +18,65 @@
 #include <vector>
 
 #include "hst/event.h"
+#include "hst/function-ref.h"
 
 namespace hst {
 
+class Environment;
+
 //------------------------------------------------------------------------------
 // Process interfaces
 
 class Process {
   public:
     class Bag;
+    class IndexSet;
     class Set;
     using Index = unsigned int;
 
     virtual ~Process() = default;
 
     Index index() const { return index_; }
+    Environment* environment() const { return environment_; }
 
     // Calls `op` for each initial event of this process.  You CAN call `op`
     // multiple times for any given initial event if that makes your
     // implementation easier; it's up to the caller to deduplicate events if
     // they need to.
-    virtual void initials(std::function<void(Event)> op) const = 0;
+    virtual void initials(function_ref<void(Event)> op) const = 0;
 
     // Calls `op` for each subprocess that you reach after following a single
     // `initial` event from this process.  You CAN call `op` multiple times for
     // any given process if that makes your implementation easier; it's up to
     // the caller to deduplicate events if they need to.
     virtual void
-    afters(Event initial, std::function<void(const Process&)> op) const = 0;
+    afters(Event initial, function_ref<void(const Process&)> op) const = 0;
 
     // Calls `op` for each syntactic subprocesses of this process.  This should
     // only include the subprocesses that are needed to print out the definition
     // of this process.  You CAN call `op` multiple times for any given process
     // if that makes your implementation easier; it's up to the caller to
     // deduplicate events if they need to.
-    virtual void subprocesses(std::function<void(const Process&)> op) const = 0;
+    virtual void subprocesses(function_ref<void(const Process&)> op) const = 0;
+
+    // Calls `op` for each outgoing transition of this process.  All of the
+    // transitions for a particular event are reported together.  If this
+    // process's environment is caching transitions, then we only calculate
+    // them from the operational semantics once, and read them back from the
+    // cache after that.  (Otherwise, like afters(), you CAN see a particular
+    // transition multiple times.)
+    void transitions(function_ref<void(Event, const Process&)> op) const;
+
+    // Calls `op` for each subprocess that you reach after following a single
+    // `initial` event from this process.  This is the same as afters(), except
+    // that it uses the environment's transition cache if it's enabled.
+    void
+    transitions(Event initial, function_ref<void(const Process&)> op) const;
+
+    // Adds each initial event of this process to `out`.  This is the same as
+    // initials(), except that it uses the environment's transition cache if
+    // it's enabled.
+    void cached_initials(Event::Set* out) const;
 
     // Legacy signatures; only here until we can migrate everything over to the
     // new signatures above.
@@ -63,14 +87,35 @@ class Process {
     // Performs a breadth-first search of the reachable subprocesses, calling
     // `op` for each one.  We guarantee that we'll call op() at most once for
     // each reachable subprocess.
-    void bfs(std::function<void(const Process&)> op) const;
+    void bfs(function_ref<void(const Process&)> op) const;
+
+    // Same as bfs(), but uses `threads` worker threads to expand each level of
+    // the search in parallel.  We still call `op` exactly once for each
+    // reachable subprocess, and always from the calling thread, but the order
+    // of the processes within each level is not deterministic.  If the
+    // environment is caching transitions, this falls back on bfs().
+    void parallel_bfs(unsigned int threads,
+                      function_ref<void(const Process&)> op) const;
 
     // Performs a breadth-first search of the syntactic subprocesses, calling
     // `op` for each one.  We guarantee that we'll call op() at most once for
     // each` syntactic subprocess.
-    void bfs_syntactic(std::function<void(const Process&)> op) const;
-
-    virtual std::size_t hash() const = 0;
+    void bfs_syntactic(function_ref<void(const Process&)> op) const;
+
+    // Returns a hash of this process.  This is calculated once, when the
+    // process is registered with its environment.
+    std::size_t hash() const { return hash_; }
+
+    // Calculates the hash of this process.  Each process is hash-consed, so
+    // any subprocesses will already have been registered by the time this is
+    // called; you should use their cached hash() values (or their addresses)
+    // rather than descending into them.  That keeps hashing O(arity) instead
+    // of O(size of the whole term).
+    virtual std::size_t compute_hash() const = 0;
+
+    // Compares two processes for equality.  For the same reason as above, you
+    // should compare subprocesses by their addresses, and not by recursively
+    // comparing their contents.
     virtual bool operator==(const Process& other) const = 0;
     bool operator!=(const Process& other) const { return !(*this == other); }
 
@@ -98,7 +143,9 @@ class Process {
 
   private:
     friend class Environment;
+    Environment* environment_;
     Index index_;
+    std::size_t hash_;
 };
 
 inline std::ostream&
@@ -112,15 +159,15 @@ class NormalizedProcess : public Process {
   public:
     virtual const NormalizedProcess* after(Event initial) const = 0;
     void
-    afters(Event initial, std::function<void(const Process&)> op) const final;
+    afters(Event initial, function_ref<void(const Process&)> op) const final;
 
     // Returns the set of non-normalized processes that this normalized process
     // represents.
-    virtual void expand(std::function<void(const Process&)> op) const = 0;
+    virtual void expand(function_ref<void(const Process&)> op) const = 0;
 
     // Same as Process::bfs, but the visitor takes in a NormalizedProcess
     // instead of a Process.
-    void bfs(std::function<void(const NormalizedProcess&)> op) const;
+    void bfs(function_ref<void(const NormalizedProcess&)> op) const;
 };
 
 class Process::Bag : public std::unordered_multiset<const Process*> {
@@ -146,11 +193,44 @@ class Process::Set : public std::unordered_set<const Process*> {
 
     // Updates this set of processes to be τ-closed.  (That is, we add any
     // additional processes you can reach by following τ one or more times.)
+    // The closure of each process is cached in its environment.
     void tau_close();
 };
 
 std::ostream& operator<<(std::ostream& out, const Process::Set& processes);
 
+// A set of processes from a single environment, stored as a bitmap of their
+// indices.  This only needs a single bit for each process in the environment,
+// so it's much more compact than a Process::Set when you need to keep track of
+// a large fraction of the processes in the environment (for instance, the
+// processes that you've already visited during a search).  The bitmap grows
+// automatically as you add processes with larger indices.
+class Process::IndexSet {
+  public:
+    bool contains(const Process& process) const
+    {
+        Index index = process.index();
+        return index < bits_.size() && bits_[index];
+    }
+
+    // Adds `process` to the set, returning whether it wasn't already there.
+    bool insert(const Process& process)
+    {
+        Index index = process.index();
+        if (index >= bits_.size()) {
+            bits_.resize(std::max<std::size_t>(index + 1, bits_.size() * 2));
+        }
+        if (bits_[index]) {
+            return false;
+        }
+        bits_[index] = true;
+        return true;
+    }
+
+  private:
+    std::vector<bool> bits_;
+};
+
 }  // namespace hst
 
 namespace std {
@@ -190,76 +270,79 @@ struct hash<hst::Process::Set>
 namespace hst {
 
 inline void
-Process::bfs(std::function<void(const Process&)> op) const
+Process::bfs(function_ref<void(const Process&)> op) const
 {
-    std::unordered_set<const Process*> seen;
-    std::unordered_set<const Process*> queue;
-    seen.insert(this);
-    queue.insert(this);
+    // The frontiers are plain vectors, and we use a bitmap of process indices
+    // to track which processes we've already seen, so the search only needs a
+    // couple of bits of bookkeeping for each process that isn't in the current
+    // or next frontier.
+    IndexSet seen;
+    std::vector<const Process*> queue;
+    std::vector<const Process*> next_queue;
+    seen.insert(*this);
+    queue.push_back(this);
     while (!queue.empty()) {
-        std::unordered_set<const Process*> next_queue;
         for (const Process* process : queue) {
             op(*process);
-            process->initials([process, &op, &seen,
-                               &next_queue](Event initial) {
-                process->afters(initial, [&op, &seen,
-                                          &next_queue](const Process& after) {
-                    bool was_added = seen.insert(&after).second;
-                    if (was_added) {
-                        next_queue.insert(&after);
-                    }
-                });
-            });
+            process->transitions(
+                    [&seen, &next_queue](Event, const Process& after) {
+                        bool was_added = seen.insert(after);
+                        if (was_added) {
+                            next_queue.push_back(&after);
+                        }
+                    });
         }
         std::swap(queue, next_queue);
+        next_queue.clear();
     }
 }
 
 inline void
-NormalizedProcess::bfs(std::function<void(const NormalizedProcess&)> op) const
+NormalizedProcess::bfs(function_ref<void(const NormalizedProcess&)> op) const
 {
-    std::unordered_set<const NormalizedProcess*> seen;
-    std::unordered_set<const NormalizedProcess*> queue;
-    seen.insert(this);
-    queue.insert(this);
+    IndexSet seen;
+    std::vector<const NormalizedProcess*> queue;
+    std::vector<const NormalizedProcess*> next_queue;
+    seen.insert(*this);
+    queue.push_back(this);
     while (!queue.empty()) {
-        std::unordered_set<const NormalizedProcess*> next_queue;
         for (const NormalizedProcess* process : queue) {
             op(*process);
-            Event::Set initials;
             process->initials([process, &seen, &next_queue](Event initial) {
                 const NormalizedProcess* after = process->after(initial);
                 assert(after);
-                bool was_added = seen.insert(after).second;
+                bool was_added = seen.insert(*after);
                 if (was_added) {
-                    next_queue.insert(after);
+                    next_queue.push_back(after);
                 }
             });
         }
         std::swap(queue, next_queue);
+        next_queue.clear();
     }
 }
 
 inline void
-Process::bfs_syntactic(std::function<void(const Process&)> op) const
+Process::bfs_syntactic(function_ref<void(const Process&)> op) const
 {
-    std::unordered_set<const Process*> seen;
-    std::unordered_set<const Process*> queue;
-    seen.insert(this);
-    queue.insert(this);
+    IndexSet seen;
+    std::vector<const Process*> queue;
+    std::vector<const Process*> next_queue;
+    seen.insert(*this);
+    queue.push_back(this);
     while (!queue.empty()) {
-        std::unordered_set<const Process*> next_queue;
         for (const Process* process : queue) {
             op(*process);
             process->subprocesses(
                     [&seen, &next_queue](const Process& subprocess) {
-                        bool was_added = seen.insert(&subprocess).second;
+                        bool was_added = seen.insert(subprocess);
                         if (was_added) {
-                            next_queue.insert(&subprocess);
+                            next_queue.push_back(&subprocess);
                         }
                     });
         }
         std::swap(queue, next_queue);
+        next_queue.clear();
     }
 }
 
@@ -8,7 +8,6 @@
 #include "hst/recursion.h"
 
 #include <assert.h>
-#include <functional>
 #include <set>
 #include <sstream>
 #include <string>
@@ -16,6 +15,7 @@
 
 #include "hst/environment.h"
 #include "hst/event.h"
+#include "hst/function-ref.h"
 #include "hst/hash.h"
 #include "hst/process.h"
 
@@ -52,11 +52,11 @@ RecursiveProcess*
 Environment::recursive_process(RecursionScope::ID scope,
                                const std::string& name)
 {
-    return register_process(new RecursiveProcess(this, scope, std::move(name)));
+    return register_process<RecursiveProcess>(this, scope, name);
 }
 
 void
-RecursiveProcess::initials(std::function<void(Event)> op) const
+RecursiveProcess::initials(function_ref<void(Event)> op) const
 {
     assert(filled());
     definition_->initials(op);
@@ -64,21 +64,21 @@ RecursiveProcess::initials(std::function<void(Event)> op) const
 
 void
 RecursiveProcess::afters(Event initial,
-                         std::function<void(const Process&)> op) const
+                         function_ref<void(const Process&)> op) const
 {
     assert(filled());
     definition_->afters(initial, op);
 }
 
 void
-RecursiveProcess::subprocesses(std::function<void(const Process&)> op) const
+RecursiveProcess::subprocesses(function_ref<void(const Process&)> op) const
 {
     assert(filled());
     op(*definition_);
 }
 
 std::size_t
-RecursiveProcess::hash() const
+RecursiveProcess::compute_hash() const
 {
     static hash_scope recursion;
     return hasher(recursion).add(env_).add(scope_).add(name_).value();
@@ -8,11 +8,11 @@
 #ifndef HST_RECURSION_H
 #define HST_RECURSION_H
 
-#include <functional>
 #include <string>
 #include <unordered_map>
 
 #include "hst/event.h"
+#include "hst/function-ref.h"
 #include "hst/process.h"
 
 namespace hst {
@@ -52,15 +52,15 @@ class RecursiveProcess : public Process {
     {
     }
 
-    void initials(std::function<void(Event)> op) const override;
+    void initials(function_ref<void(Event)> op) const override;
     void afters(Event initial,
-                std::function<void(const Process&)> op) const override;
-    void subprocesses(std::function<void(const Process&)> op) const override;
+                function_ref<void(const Process&)> op) const override;
+    void subprocesses(function_ref<void(const Process&)> op) const override;
 
     const std::string& name() const { return name_; }
     const Process* definition() const { return definition_; }
     bool filled() const { return definition_; }
-    std::size_t hash() const override;
+    std::size_t compute_hash() const override;
     bool operator==(const Process& other) const override;
     unsigned int precedence() const override { return 0; }
     void print(std::ostream& out) const override;
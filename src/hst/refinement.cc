@@ -7,73 +7,416 @@
 
 #include "hst/refinement.h"
 
-#include <unordered_set>
-
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hst/chunked-array.h"
 #include "hst/environment.h"
 #include "hst/event.h"
-#include "hst/hash.h"
+#include "hst/probabilistic-set.h"
 #include "hst/process.h"
+#include "hst/run-file.h"
 #include "hst/semantic-models.h"
 
 namespace hst {
 
 namespace {
 
+// A refinement pair is packed into a single 64-bit word, with the index of the
+// spec process in the upper half and the index of the impl process in the lower
+// half.  Both processes live in the same environment, so we can always turn the
+// indices back into processes.
+using PackedPair = std::uint64_t;
+
+std::uint64_t
+hash_pair(PackedPair pair)
+{
+    // Mix the high bits into the low bits, since hash tables use the low bits
+    // of the hash to choose a slot.
+    pair *= UINT64_C(0x9e3779b97f4a7c15);
+    return pair ^ (pair >> 32);
+}
+
+// The behavior of each Spec state that a refinement check has reached.  A
+// normalized Spec typically has far fewer states than there are pairs in the
+// check, and calculating a state's behavior means expanding every process in
+// its equivalence class, so we only want to do that once per state.  This
+// isn't thread-safe; each worker of a parallel check keeps its own copy.
 template <typename Model>
-class RefinementPair {
+class SpecBehaviors {
   public:
-    using Set = std::unordered_set<RefinementPair<Model>>;
+    const typename Model::Behavior& get(const NormalizedProcess& spec)
+    {
+        auto it = behaviors_.find(spec.index());
+        if (it == behaviors_.end()) {
+            it = behaviors_
+                         .emplace(spec.index(),
+                                  Model::get_process_behavior(spec))
+                         .first;
+        }
+        return it->second;
+    }
+
+  private:
+    std::unordered_map<Process::Index, typename Model::Behavior> behaviors_;
+};
 
+template <typename Model>
+class RefinementPair {
+  public:
     RefinementPair(const NormalizedProcess* spec, const Process* impl)
         : spec_(spec), impl_(impl)
     {
     }
 
+    RefinementPair(const Environment& env, PackedPair packed)
+        : spec_(static_cast<const NormalizedProcess*>(
+                  env.process(packed >> 32))),
+          impl_(env.process(packed & 0xffffffff))
+    {
+    }
+
+    PackedPair pack() const
+    {
+        return (PackedPair(spec_->index()) << 32) | impl_->index();
+    }
+
+    const NormalizedProcess* spec() const { return spec_; }
+    const Process* impl() const { return impl_; }
+
     // Returns whether Spec's behavior refines Impl's behavior.  (This is not a
     // deep refinement check; it's used to construct the deep refinement check.)
-    bool behavior_refines() const;
+    // We look up Spec's behavior in `behaviors`.
+    bool behavior_refines(SpecBehaviors<Model>* behaviors) const;
 
     // Returns the initials of Impl
     void impl_initials(Event::Set* out) const;
 
-    // For a particular Impl initial event, enqueues a new refinement pair for
-    // each Impl after.  Returns false if Spec cannot perform `initial` (meaning
-    // the overall refinement check fails).
-    bool enqueue_afters(Event initial, Set* enqueued, Set* pending) const;
-
-    std::size_t hash() const;
-    bool operator==(const RefinementPair<Model>& other) const;
+    // For a particular Impl initial event, calls `op` with `initial` and a new
+    // refinement pair for each Impl after.  Returns false if Spec cannot
+    // perform `initial` (meaning the overall refinement check fails).
+    template <typename F>
+    bool afters(Event initial, const F& op) const;
+
+    // Checks this pair's behavior, and then calls `op` for each pair that you
+    // can reach from it by following a single Impl event.  Returns false if
+    // this pair fails the refinement check.  If that's because Spec can't
+    // perform one of Impl's events, we fill in `failed_event` with that event;
+    // if it's because their behaviors don't match, we fill it in with
+    // Event::none().  `behaviors` caches Spec's behaviors across pairs, and
+    // `initials` is scratch space.
+    template <typename F>
+    bool expand(SpecBehaviors<Model>* behaviors, Event::Set* initials,
+                Event* failed_event, const F& op) const;
 
   private:
     const NormalizedProcess* spec_;
     const Process* impl_;
 };
 
-}  // namespace
+// Every pair that a refinement check has discovered, in the order that we
+// discovered them, along with the pair and event that we first reached it
+// from.  That lets us walk backwards from any pair to the root to construct a
+// counterexample.  Each pair gets a dense 32-bit ID, which is its position in
+// the log; the root pair is always ID 0.
+class PairLog {
+  public:
+    using ID = std::uint32_t;
 
-}  // namespace hst
+    struct Predecessor {
+        Predecessor() : parent(0), event(Event::none()) {}
+        Predecessor(ID parent, Event event) : parent(parent), event(event) {}
+        ID parent;
+        Event event;
+    };
 
-namespace std {
+    PairLog() : size_(0) {}
 
-template <typename Model>
-struct hash<hst::RefinementPair<Model>>
+    // Adds a new pair to the log, returning its ID.  This is safe to call from
+    // multiple threads at once.
+    ID add(PackedPair pair, Predecessor predecessor)
+    {
+        ID id = size_.fetch_add(1);
+        pairs_.slot(id) = pair;
+        predecessors_.slot(id) = predecessor;
+        return id;
+    }
+
+    std::size_t size() const { return size_.load(); }
+    PackedPair pair(ID id) const { return pairs_[id]; }
+    const Predecessor& predecessor(ID id) const { return predecessors_[id]; }
+
+  private:
+    ChunkedArray<PackedPair> pairs_;
+    ChunkedArray<Predecessor> predecessors_;
+    std::atomic<ID> size_;
+};
+
+// An open-addressing hash set of the pairs in a PairLog.  Each slot only holds
+// the 32-bit ID of a pair; we look in the log to see which pair that is.
+class PairSet {
+  public:
+    explicit PairSet(PairLog* log) : log_(log), slots_(1024, empty) {}
+
+    // Adds `pair` to the set (and to the log, with the given predecessor) if
+    // it isn't already there.  Returns whether it was added.
+    bool insert(PackedPair pair, PairLog::Predecessor predecessor,
+                PairLog::ID* id)
+    {
+        if ((size_ + 1) * 4 > slots_.size() * 3) {
+            grow();
+        }
+        std::size_t mask = slots_.size() - 1;
+        for (std::size_t i = hash_pair(pair) & mask;; i = (i + 1) & mask) {
+            PairLog::ID& slot = slots_[i];
+            if (slot == empty) {
+                slot = *id = log_->add(pair, predecessor);
+                ++size_;
+                return true;
+            }
+            if (log_->pair(slot) == pair) {
+                *id = slot;
+                return false;
+            }
+        }
+    }
+
+  private:
+    static const PairLog::ID empty = ~PairLog::ID(0);
+
+    void grow()
+    {
+        std::vector<PairLog::ID> slots(slots_.size() * 2, empty);
+        std::size_t mask = slots.size() - 1;
+        for (PairLog::ID id : slots_) {
+            if (id == empty) {
+                continue;
+            }
+            std::size_t i = hash_pair(log_->pair(id)) & mask;
+            while (slots[i] != empty) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = id;
+        }
+        std::swap(slots_, slots);
+    }
+
+    PairLog* log_;
+    std::vector<PairLog::ID> slots_;
+    std::size_t size_ = 0;
+};
+
+const PairLog::ID PairSet::empty;
+
+// A PairSet that can be safely updated from multiple threads.  The set is split
+// into shards, each with its own lock, using the high bits of each pair's hash
+// to choose its shard.  All of the shards share the same log.
+class ConcurrentPairSet {
+  public:
+    explicit ConcurrentPairSet(PairLog* log)
+    {
+        for (std::size_t i = 0; i < shard_count; i++) {
+            shards_.emplace_back(new Shard(log));
+        }
+    }
+
+    bool insert(PackedPair pair, PairLog::Predecessor predecessor,
+                PairLog::ID* id)
+    {
+        Shard& shard = *shards_[hash_pair(pair) >> (64 - shard_bits)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return shard.pairs.insert(pair, predecessor, id);
+    }
+
+  private:
+    struct Shard {
+        explicit Shard(PairLog* log) : pairs(log) {}
+        std::mutex mutex;
+        PairSet pairs;
+    };
+
+    static const std::size_t shard_bits = 6;
+    static const std::size_t shard_count = std::size_t(1) << shard_bits;
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+// Fills in `counterexample` for the failing pair `pair`, which Impl reaches by
+// following `events`.  The τ steps that Impl takes are invisible, so we leave
+// them out of the trace.
+void
+fill_counterexample(const Environment& env, PackedPair pair,
+                    const std::vector<Event>& events, Event failed_event,
+                    RefinementCounterexample* counterexample)
 {
-    std::size_t operator()(const hst::RefinementPair<Model>& pair) const
+    std::vector<Event> visible;
+    for (Event event : events) {
+        if (event != Event::tau()) {
+            visible.push_back(event);
+        }
+    }
+    counterexample->trace = Trace(std::move(visible));
+    counterexample->spec =
+            static_cast<const NormalizedProcess*>(env.process(pair >> 32));
+    counterexample->impl = env.process(pair & 0xffffffff);
+    counterexample->event = failed_event;
+}
+
+// Fills in `counterexample` with the path through the refinement check that
+// leads to the failing pair `id`.
+void
+build_counterexample(const Environment& env, const PairLog& log,
+                     PairLog::ID id, Event failed_event,
+                     RefinementCounterexample* counterexample)
+{
+    PackedPair pair = log.pair(id);
+    std::vector<Event> events;
+    while (id != 0) {
+        const PairLog::Predecessor& predecessor = log.predecessor(id);
+        events.push_back(predecessor.event);
+        id = predecessor.parent;
+    }
+    std::reverse(events.begin(), events.end());
+    fill_counterexample(env, pair, events, failed_event, counterexample);
+}
+
+// The pairs that a depth-first refinement check has visited.  If the search has
+// a depth bound, we also remember the shallowest depth at which we've reached
+// each pair, since reaching it again at a shallower depth means that we can
+// explore more of the pairs beyond it before hitting the bound.
+class DepthSet {
+  public:
+    DepthSet() : slots_(1024) {}
+
+    // Records that we've reached `pair` at `depth`.  Returns whether we need to
+    // (re)explore it, i.e. whether we hadn't already reached it at the same
+    // depth or shallower.
+    bool visit(PackedPair pair, std::uint32_t depth)
+    {
+        if ((size_ + 1) * 4 > slots_.size() * 3) {
+            grow();
+        }
+        Slot& slot = find(&slots_, pair);
+        if (slot.pair == empty) {
+            slot.pair = pair;
+            slot.depth = depth;
+            ++size_;
+            return true;
+        }
+        if (depth < slot.depth) {
+            slot.depth = depth;
+            return true;
+        }
+        return false;
+    }
+
+  private:
+    static const PackedPair empty = ~PackedPair(0);
+
+    struct Slot {
+        PackedPair pair = empty;
+        std::uint32_t depth = 0;
+    };
+
+    static Slot& find(std::vector<Slot>* slots, PackedPair pair)
+    {
+        std::size_t mask = slots->size() - 1;
+        std::size_t i = hash_pair(pair) & mask;
+        while ((*slots)[i].pair != pair && (*slots)[i].pair != empty) {
+            i = (i + 1) & mask;
+        }
+        return (*slots)[i];
+    }
+
+    void grow()
     {
-        return pair.hash();
+        std::vector<Slot> slots(slots_.size() * 2);
+        for (const Slot& slot : slots_) {
+            if (slot.pair != empty) {
+                find(&slots, slot.pair) = slot;
+            }
+        }
+        std::swap(slots_, slots);
     }
+
+    std::vector<Slot> slots_;
+    std::size_t size_ = 0;
 };
 
-}  // namespace std
+const PackedPair DepthSet::empty;
 
-namespace hst {
+// A parallel worker's queue of pairs that still need to be checked.  The owning
+// worker pushes and pops pairs at the back; other workers steal pairs from the
+// front.
+class WorkQueue {
+  public:
+    void push(PairLog::ID pair)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pairs_.push_back(pair);
+    }
+
+    bool pop(PairLog::ID* pair)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pairs_.empty()) {
+            return false;
+        }
+        *pair = pairs_.back();
+        pairs_.pop_back();
+        return true;
+    }
+
+    // Moves (up to) half of the pairs at the front of this queue into
+    // `stolen`.
+    void steal(std::vector<PairLog::ID>* stolen)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::size_t count = (pairs_.size() + 1) / 2;
+        stolen->insert(stolen->end(), pairs_.begin(), pairs_.begin() + count);
+        pairs_.erase(pairs_.begin(), pairs_.begin() + count);
+    }
+
+  private:
+    std::mutex mutex_;
+    std::deque<PairLog::ID> pairs_;
+};
+
+// Returns whether Spec allows Impl to do anything at all from this point on.
+// That only happens in models that track divergence: a divergent Spec is
+// refined by every process, so we don't need to explore any of its afters.
+template <typename Model>
+bool
+spec_is_chaotic(const typename Model::Behavior&)
+{
+    return false;
+}
+
+template <>
+bool
+spec_is_chaotic<FailuresDivergences>(
+        const FailuresDivergences::Behavior& spec)
+{
+    return spec.divergent();
+}
+
+}  // namespace
 
 template <typename Model>
 bool
-RefinementPair<Model>::behavior_refines() const
+RefinementPair<Model>::behavior_refines(SpecBehaviors<Model>* behaviors) const
 {
-    typename Model::Behavior spec_behavior =
-            Model::get_process_behavior(*spec_);
+    const typename Model::Behavior& spec_behavior = behaviors->get(*spec_);
     typename Model::Behavior impl_behavior =
             Model::get_process_behavior(*impl_);
     return spec_behavior.refined_by(impl_behavior);
@@ -83,13 +426,13 @@ template <typename Model>
 void
 RefinementPair<Model>::impl_initials(Event::Set* out) const
 {
-    impl_->initials(out);
+    impl_->cached_initials(out);
 }
 
 template <typename Model>
+template <typename F>
 bool
-RefinementPair<Model>::enqueue_afters(Event initial, Set* enqueued,
-                                      Set* pending) const
+RefinementPair<Model>::afters(Event initial, const F& op) const
 {
     const NormalizedProcess* spec_after =
             initial == Event::tau() ? spec_ : spec_->after(initial);
@@ -101,69 +444,465 @@ RefinementPair<Model>::enqueue_afters(Event initial, Set* enqueued,
 
     // Otherwise we need to create a new refinement pair for the single after of
     // spec and all of the afters of impl.
-    Process::Set impl_afters;
-    impl_->afters(initial, &impl_afters);
-    for (const Process* impl_after : impl_afters) {
-        RefinementPair pair(spec_after, impl_after);
-        bool added = enqueued->insert(pair).second;
-        if (added) {
-            pending->insert(pair);
+    impl_->transitions(initial,
+                       [initial, spec_after, &op](const Process& impl_after) {
+                           op(initial, RefinementPair(spec_after, &impl_after));
+                       });
+    return true;
+}
+
+template <typename Model>
+template <typename F>
+bool
+RefinementPair<Model>::expand(SpecBehaviors<Model>* behaviors,
+                              Event::Set* initials, Event* failed_event,
+                              const F& op) const
+{
+    if (spec_is_chaotic<Model>(behaviors->get(*spec_))) {
+        return true;
+    }
+
+    // We check Impl's events first, since a particular event that Spec can't
+    // follow makes for a more useful counterexample than a mismatched
+    // behavior.
+    initials->clear();
+    impl_initials(initials);
+    for (const Event& initial : *initials) {
+        if (!afters(initial, op)) {
+            *failed_event = initial;
+            return false;
         }
     }
+
+    if (!behavior_refines(behaviors)) {
+        *failed_event = Event::none();
+        return false;
+    }
     return true;
 }
 
+namespace {
+
+// Returns the events along a path from the root pair to `target`, which must
+// be in the last run of `levels`.  We don't record any predecessors during an
+// external search, so we find them by walking backwards through the levels,
+// and scanning each one for a pair that `target` is a successor of.
 template <typename Model>
-std::size_t
-RefinementPair<Model>::hash() const
+std::vector<Event>
+trace_back(const Environment& env, RunFile* levels, PackedPair target)
 {
-    static hash_scope refinement;
-    return hasher(refinement).add(spec_).add(impl_).value();
+    std::vector<Event> events;
+    SpecBehaviors<Model> behaviors;
+    Event::Set initials;
+    for (std::size_t i = levels->run_count() - 1; i > 0; --i) {
+        PackedPair parent;
+        Event event = Event::none();
+        Event unused = Event::none();
+        bool found = false;
+        levels->rewind(i - 1);
+        while (!found && levels->next(&parent)) {
+            RefinementPair<Model>(env, parent)
+                    .expand(&behaviors, &initials, &unused,
+                            [target, &found, &event](
+                                    Event initial,
+                                    const RefinementPair<Model>& after) {
+                                if (!found && after.pack() == target) {
+                                    found = true;
+                                    event = initial;
+                                }
+                            });
+        }
+        events.push_back(event);
+        target = parent;
+    }
+    std::reverse(events.begin(), events.end());
+    return events;
 }
 
+}  // namespace
+
 template <typename Model>
 bool
-RefinementPair<Model>::operator==(const RefinementPair<Model>& other) const
+RefinementChecker<Model>::refines(
+        const NormalizedProcess* spec, const Process* impl,
+        RefinementCounterexample* counterexample) const
 {
-    return spec_ == other.spec_ && impl_ == other.impl_;
+    switch (search_) {
+        case RefinementSearch::depth_first:
+            return depth_first(spec, impl, counterexample);
+        case RefinementSearch::external_breadth_first:
+            return external_breadth_first(spec, impl, counterexample);
+        default:
+            return breadth_first(spec, impl, counterexample);
+    }
 }
 
 template <typename Model>
 bool
-RefinementChecker<Model>::refines(const NormalizedProcess* spec,
-                                  const Process* impl) const
+RefinementChecker<Model>::breadth_first(
+        const NormalizedProcess* spec, const Process* impl,
+        RefinementCounterexample* counterexample) const
 {
-    typename RefinementPair<Model>::Set enqueued;
-    typename RefinementPair<Model>::Set queue;
-
-    RefinementPair<Model> root(spec, impl);
-    enqueued.insert(root);
-    queue.insert(root);
-
-    while (!queue.empty()) {
-        typename RefinementPair<Model>::Set pending;
-        for (const RefinementPair<Model>& pair : queue) {
-            if (!pair.behavior_refines()) {
-                // TODO: Construct a counterexample
-                return false;
+    // We only store packed pairs in the log, and turn them back into processes
+    // as we check them.  The log holds the pairs in the order that we
+    // discovered them, so it doubles as our FIFO queue, and we visit pairs in
+    // breadth-first order.  That also means that the first failing pair that
+    // we find has the shortest possible counterexample.
+    const Environment& env = *impl->environment();
+    PairLog log;
+    PairSet visited(&log);
+    PairLog::ID id;
+    visited.insert(RefinementPair<Model>(spec, impl).pack(),
+                   PairLog::Predecessor(), &id);
+
+    SpecBehaviors<Model> behaviors;
+    Event::Set initials;
+    for (PairLog::ID current = 0; current < log.size(); ++current) {
+        auto enqueue = [&visited, &id, current](
+                               Event initial,
+                               const RefinementPair<Model>& pair) {
+            visited.insert(pair.pack(), PairLog::Predecessor(current, initial),
+                           &id);
+        };
+        RefinementPair<Model> pair(env, log.pair(current));
+        Event failed_event = Event::none();
+        if (!pair.expand(&behaviors, &initials, &failed_event, enqueue)) {
+            if (counterexample) {
+                build_counterexample(env, log, current, failed_event,
+                                     counterexample);
             }
+            return false;
+        }
+    }
 
-            Event::Set initials;
-            pair.impl_initials(&initials);
-            for (const Event& initial : initials) {
-                if (!pair.enqueue_afters(initial, &enqueued, &pending)) {
-                    // TODO: Construct a counterexample
-                    return false;
+    return true;
+}
+
+template <typename Model>
+bool
+RefinementChecker<Model>::depth_first(
+        const NormalizedProcess* spec, const Process* impl,
+        RefinementCounterexample* counterexample) const
+{
+    // Each frame on the stack is a pair on the current path, along with the
+    // event that we followed to reach it.  The successors of every pair on the
+    // path live in a single shared stack; each frame remembers which of those
+    // successors are its own, and which of them it hasn't explored yet.
+    struct Successor {
+        Event event;
+        PackedPair pair;
+    };
+    struct Frame {
+        Event event;
+        PackedPair pair;
+        std::size_t begin;
+        std::size_t next;
+        std::size_t end;
+    };
+
+    const Environment& env = *impl->environment();
+    // Without a depth bound, we record every pair at depth 0, so that we never
+    // explore any pair more than once.
+    const bool bounded = max_depth_ != 0;
+    DepthSet exact;
+    ProbabilisticSet* probabilistic = visited_;
+    auto visit = [bounded, &exact, probabilistic](PackedPair pair,
+                                                  std::uint32_t depth) {
+        if (probabilistic) {
+            return probabilistic->insert(pair);
+        }
+        return exact.visit(pair, bounded ? depth : 0);
+    };
+    std::vector<Frame> path;
+    std::vector<Successor> successors;
+    SpecBehaviors<Model> behaviors;
+    Event::Set initials;
+
+    // Checks `pair`, pushing a new frame for it onto the path if it passes.
+    // Returns false (filling in the counterexample) if it fails.
+    auto push = [&env, &path, &successors, &behaviors, &initials,
+                 counterexample](Event event, PackedPair packed) {
+        std::size_t begin = successors.size();
+        RefinementPair<Model> pair(env, packed);
+        Event failed_event = Event::none();
+        bool passed = pair.expand(
+                &behaviors, &initials, &failed_event,
+                [&successors](Event initial,
+                              const RefinementPair<Model>& after) {
+                    successors.push_back(Successor{initial, after.pack()});
+                });
+        if (!passed) {
+            if (counterexample) {
+                std::vector<Event> events;
+                for (std::size_t i = 1; i < path.size(); ++i) {
+                    events.push_back(path[i].event);
                 }
+                if (!path.empty()) {
+                    events.push_back(event);
+                }
+                fill_counterexample(env, packed, events, failed_event,
+                                    counterexample);
             }
+            return false;
         }
+        path.push_back(Frame{event, packed, begin, begin, successors.size()});
+        return true;
+    };
 
-        std::swap(queue, pending);
+    PackedPair root = RefinementPair<Model>(spec, impl).pack();
+    visit(root, 0);
+    if (!push(Event::none(), root)) {
+        return false;
+    }
+
+    while (!path.empty()) {
+        Frame& top = path.back();
+        if (top.next == top.end) {
+            successors.erase(successors.begin() + top.begin,
+                             successors.end());
+            path.pop_back();
+            continue;
+        }
+
+        Successor successor = successors[top.next++];
+        std::uint32_t depth = path.size();
+        if (bounded && depth > max_depth_) {
+            continue;
+        }
+        if (!visit(successor.pair, depth)) {
+            continue;
+        }
+        if (!push(successor.event, successor.pair)) {
+            return false;
+        }
     }
 
     return true;
 }
 
+template <typename Model>
+bool
+RefinementChecker<Model>::external_breadth_first(
+        const NormalizedProcess* spec, const Process* impl,
+        RefinementCounterexample* counterexample) const
+{
+    // We keep every level's pairs as a separate run in a single file, so that
+    // we can walk backwards through them to construct a counterexample without
+    // needing a file descriptor for each level.  We keep the union of all of
+    // the levels in a separate run, so that we can find the duplicates in each
+    // new level with a single merge pass.
+    using Run = std::unique_ptr<RunFile>;
+    const Environment& env = *impl->environment();
+    PackedPair root = RefinementPair<Model>(spec, impl).pack();
+    Run visited(new RunFile(external_directory_));
+    visited->append(root);
+    visited->finish();
+    Run levels(new RunFile(external_directory_));
+    levels->append(root);
+    levels->finish();
+
+    SpecBehaviors<Model> behaviors;
+    Event::Set initials;
+    while (levels->size() != 0) {
+        // Expand the current level into a collection of sorted runs.
+        std::vector<Run> runs;
+        std::vector<PackedPair> buffer;
+        auto flush = [this, &runs, &buffer]() {
+            std::sort(buffer.begin(), buffer.end());
+            buffer.erase(std::unique(buffer.begin(), buffer.end()),
+                         buffer.end());
+            runs.emplace_back(new RunFile(external_directory_));
+            for (PackedPair pair : buffer) {
+                runs.back()->append(pair);
+            }
+            runs.back()->finish();
+            buffer.clear();
+        };
+        auto enqueue = [this, &buffer, &flush](
+                               Event, const RefinementPair<Model>& after) {
+            buffer.push_back(after.pack());
+            if (buffer.size() >= run_size_) {
+                flush();
+            }
+        };
+
+        PackedPair packed;
+        while (levels->next(&packed)) {
+            RefinementPair<Model> pair(env, packed);
+            Event failed_event = Event::none();
+            if (!pair.expand(&behaviors, &initials, &failed_event,
+                             enqueue)) {
+                if (counterexample) {
+                    std::vector<Event> events =
+                            trace_back<Model>(env, levels.get(), packed);
+                    fill_counterexample(env, packed, events, failed_event,
+                                        counterexample);
+                }
+                return false;
+            }
+        }
+        if (!buffer.empty()) {
+            flush();
+        }
+
+        // Merge the runs together, and remove any pairs that we've already
+        // visited.  Each merged pair that's new becomes part of the next level,
+        // and every pair goes into the new visited set.
+        auto greater = [](const std::pair<PackedPair, RunFile*>& lhs,
+                          const std::pair<PackedPair, RunFile*>& rhs) {
+            return lhs.first > rhs.first;
+        };
+        std::priority_queue<std::pair<PackedPair, RunFile*>,
+                            std::vector<std::pair<PackedPair, RunFile*>>,
+                            decltype(greater)>
+                heads(greater);
+        for (const Run& run : runs) {
+            PackedPair pair;
+            if (run->next(&pair)) {
+                heads.emplace(pair, run.get());
+            }
+        }
+
+        levels->start_run();
+        Run next_visited(new RunFile(external_directory_));
+        PackedPair old_pair;
+        bool has_old = visited->next(&old_pair);
+        while (!heads.empty()) {
+            PackedPair pair = heads.top().first;
+            // Pop every copy of this pair from the runs.
+            while (!heads.empty() && heads.top().first == pair) {
+                RunFile* run = heads.top().second;
+                heads.pop();
+                PackedPair following;
+                if (run->next(&following)) {
+                    heads.emplace(following, run);
+                }
+            }
+            while (has_old && old_pair < pair) {
+                next_visited->append(old_pair);
+                has_old = visited->next(&old_pair);
+            }
+            if (has_old && old_pair == pair) {
+                continue;
+            }
+            levels->append(pair);
+            next_visited->append(pair);
+        }
+        while (has_old) {
+            next_visited->append(old_pair);
+            has_old = visited->next(&old_pair);
+        }
+        levels->finish();
+        next_visited->finish();
+        visited = std::move(next_visited);
+    }
+
+    return true;
+}
+
+template <typename Model>
+bool
+RefinementChecker<Model>::refines(
+        const NormalizedProcess* spec, const Process* impl,
+        unsigned int threads, RefinementCounterexample* counterexample) const
+{
+    const Environment& env = *impl->environment();
+    if (threads <= 1 || env.transition_cache() ||
+        search_ != RefinementSearch::breadth_first) {
+        return refines(spec, impl, counterexample);
+    }
+
+    PairLog log;
+    ConcurrentPairSet visited(&log);
+    std::vector<WorkQueue> queues(threads);
+    // The number of pairs that we've added to the visited set but haven't
+    // finished expanding yet.  We only decrement this once we've enqueued all
+    // of a pair's successors, so it only reaches 0 once the whole search is
+    // finished.
+    std::atomic<std::size_t> pending(1);
+    std::atomic<bool> failed(false);
+    // Only the first worker to find a failing pair fills these in.
+    PairLog::ID failed_id = 0;
+    Event failed_event = Event::none();
+
+    PairLog::ID root;
+    visited.insert(RefinementPair<Model>(spec, impl).pack(),
+                   PairLog::Predecessor(), &root);
+    queues[0].push(root);
+
+    auto worker = [&env, &log, &visited, &queues, &pending, &failed, &failed_id,
+                   &failed_event, threads](unsigned int self) {
+        WorkQueue& queue = queues[self];
+        SpecBehaviors<Model> behaviors;
+        Event::Set initials;
+        std::vector<PairLog::ID> stolen;
+        while (!failed.load(std::memory_order_relaxed)) {
+            PairLog::ID current;
+            if (!queue.pop(&current)) {
+                if (pending.load() == 0) {
+                    return;
+                }
+                // Our own queue is empty, so try to steal some work from the
+                // other workers, starting with our nearest neighbor.
+                for (unsigned int i = 1; i < threads && stolen.empty(); i++) {
+                    queues[(self + i) % threads].steal(&stolen);
+                }
+                if (stolen.empty()) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                for (PairLog::ID pair : stolen) {
+                    queue.push(pair);
+                }
+                stolen.clear();
+                continue;
+            }
+
+            auto enqueue = [&visited, &queue, &pending, current](
+                                   Event initial,
+                                   const RefinementPair<Model>& pair) {
+                PairLog::ID id;
+                if (visited.insert(pair.pack(),
+                                   PairLog::Predecessor(current, initial),
+                                   &id)) {
+                    pending.fetch_add(1);
+                    queue.push(id);
+                }
+            };
+            RefinementPair<Model> pair(env, log.pair(current));
+            Event event = Event::none();
+            if (!pair.expand(&behaviors, &initials, &event, enqueue)) {
+                if (!failed.exchange(true)) {
+                    failed_id = current;
+                    failed_event = event;
+                }
+                return;
+            }
+            pending.fetch_sub(1);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < threads; i++) {
+        workers.emplace_back(worker, i);
+    }
+    worker(0);
+    for (std::thread& thread : workers) {
+        thread.join();
+    }
+
+    if (!failed.load()) {
+        return true;
+    }
+    if (counterexample) {
+        build_counterexample(env, log, failed_id, failed_event,
+                             counterexample);
+    }
+    return false;
+}
+
 template class RefinementChecker<Traces>;
+template class RefinementChecker<Failures>;
+template class RefinementChecker<FailuresDivergences>;
 
 }  // namespace hst
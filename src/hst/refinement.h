@@ -8,16 +8,152 @@
 #ifndef HST_REFINEMENT_H
 #define HST_REFINEMENT_H
 
+#include <cstddef>
+#include <string>
+#include <utility>
+
 #include "hst/environment.h"
+#include "hst/event.h"
+#include "hst/probabilistic-set.h"
 #include "hst/process.h"
 #include "hst/semantic-models.h"
 
 namespace hst {
 
+// Describes why a refinement check failed.
+struct RefinementCounterexample {
+    // The visible events that Impl can perform to reach `impl`, while Spec
+    // performs the same events to reach `spec`.
+    Trace trace;
+    const NormalizedProcess* spec = nullptr;
+    const Process* impl = nullptr;
+    // An event that `impl` can perform but `spec` cannot.  If this is
+    // Event::none(), then `spec` can perform all of `impl`'s events, but the
+    // behaviors of the two processes don't match in some other way.
+    Event event = Event::none();
+};
+
+// The order in which a single-threaded refinement check explores the pairs of
+// spec and impl states.
+enum class RefinementSearch {
+    // Explores the pairs level by level.  This always finds the shortest
+    // counterexample, but has to hold the entire frontier in memory.
+    breadth_first,
+    // Follows one path at a time, using an explicit stack.  This can find deep
+    // counterexamples much more quickly, and apart from the visited set, only
+    // needs memory for the current path.
+    depth_first,
+    // Explores the pairs level by level, like breadth_first, but keeps the
+    // pairs on disk instead of in memory.  We buffer each level's successors
+    // in memory, and whenever the buffer fills up, we sort it and write it out
+    // as a compressed run file.  Once the level is finished, we merge its runs
+    // together, and remove any pairs that appear in earlier levels.  (This is
+    // known as "delayed duplicate detection".)  This lets you check processes
+    // whose pairs don't fit in memory, at the cost of reading and writing the
+    // set of visited pairs once per level.
+    external_breadth_first,
+};
+
 template <typename Model>
 class RefinementChecker {
   public:
-    bool refines(const NormalizedProcess* spec, const Process* impl) const;
+    RefinementChecker() = default;
+
+    // If `max_depth` is nonzero, a depth-first check only explores pairs that
+    // are at most that many steps (including τ steps) away from the root pair.
+    // A bounded check can only prove that there's no counterexample within
+    // the bound, so refines() returns true if it doesn't find one.
+    //
+    // If `visited` is non-null, a depth-first check uses it to remember which
+    // pairs it has already visited, instead of an exact set.  That lets you
+    // check much larger processes in a fixed amount of memory, but the check
+    // might skip some pairs, so a passing check is no longer a proof of
+    // refinement; `visited` can tell you how likely it is that we skipped any.
+    // (A failing check is still always a real counterexample.)  We don't
+    // track depths in a probabilistic set, so with a depth bound, we won't
+    // re-explore a pair if we later reach it by a shorter path.
+    explicit RefinementChecker(RefinementSearch search,
+                               std::size_t max_depth = 0,
+                               ProbabilisticSet* visited = nullptr)
+        : search_(search), max_depth_(max_depth), visited_(visited)
+    {
+    }
+
+    // Sets where an external_breadth_first check keeps its run files, and how
+    // many pairs it buffers in memory before writing them out as a new run.
+    // If `directory` is empty, we use $TMPDIR, or /tmp if that isn't set.
+    void set_external_storage(std::string directory, std::size_t run_size)
+    {
+        external_directory_ = std::move(directory);
+        run_size_ = run_size;
+    }
+
+    // Returns whether `impl` refines `spec`.  Usually `spec` will be the result
+    // of Environment::normalize.  You can also pass in a prenormalized process
+    // (from Environment::prenormalize) without normalizing it.  That skips
+    // bisimulation entirely: the spec's subset-construction states are only
+    // created as the check reaches them, so a failing check can finish without
+    // ever exploring most of the spec.  The tradeoff is that a passing check
+    // might visit more pairs, since equivalent spec states aren't merged.
+    //
+    // If refinement doesn't hold, and `counterexample` is non-null, we fill it
+    // in with a trace that demonstrates the failure.  If we search
+    // breadth-first, there's no shorter path (counting τ steps) to a failure.
+    bool refines(const NormalizedProcess* spec, const Process* impl,
+                 RefinementCounterexample* counterexample = nullptr) const;
+
+    // Same as above, but uses `threads` worker threads to explore the pairs of
+    // spec and impl states.  Each worker has its own queue of pairs, and steals
+    // pairs from the other workers' queues when its own runs dry.  All of the
+    // workers stop as soon as any of them finds a pair that fails the check.
+    // The pairs are visited in a different order than the single-threaded
+    // check, but the result is identical.  (If the environment is caching
+    // transitions, which isn't safe to do from multiple threads, we fall back
+    // on the single-threaded check.  The same goes for depth-first and
+    // external checks.)
+    // The counterexample that we fill in is valid, but isn't necessarily the
+    // shortest one.
+    bool refines(const NormalizedProcess* spec, const Process* impl,
+                 unsigned int threads,
+                 RefinementCounterexample* counterexample = nullptr) const;
+
+  private:
+    bool breadth_first(const NormalizedProcess* spec, const Process* impl,
+                       RefinementCounterexample* counterexample) const;
+    bool depth_first(const NormalizedProcess* spec, const Process* impl,
+                     RefinementCounterexample* counterexample) const;
+    bool external_breadth_first(const NormalizedProcess* spec,
+                                const Process* impl,
+                                RefinementCounterexample* counterexample) const;
+
+    RefinementSearch search_ = RefinementSearch::breadth_first;
+    std::size_t max_depth_ = 0;
+    ProbabilisticSet* visited_ = nullptr;
+    std::string external_directory_;
+    std::size_t run_size_ = std::size_t(1) << 24;
+};
+
+// Checks traces refinement without normalizing Spec first.  Instead of pairing
+// each Impl state with a single normalized Spec state, we pair it with the
+// τ-closed set of Spec states that Spec could be in after the same trace,
+// building those sets on the fly as the check reaches them.
+//
+// A pair (impl, S) is at least as hard to satisfy as (impl, S′) when S ⊆ S′,
+// since a smaller set of Spec states can perform fewer events.  So for each
+// Impl state we only keep an antichain of the minimal Spec sets that we've
+// reached it with; we skip any pair whose Spec set is a superset of one in the
+// antichain, and drop any pairs that a new, smaller set makes redundant.  On
+// heavily nondeterministic specs, this avoids most of the exponential blowup of
+// determinizing Spec up front.
+class AntichainRefinementChecker {
+  public:
+    // Returns whether `impl` refines `spec` in the traces model.  `spec` can
+    // be any process; it doesn't need to be normalized.  If refinement doesn't
+    // hold, and `counterexample` is non-null, we fill it in with a trace that
+    // demonstrates the failure; its `spec` is the prenormalization of the set
+    // of Spec states that we reached.
+    bool refines(const Process* spec, const Process* impl,
+                 RefinementCounterexample* counterexample = nullptr) const;
 };
 
 }  // namespace hst
@@ -0,0 +1,141 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "hst/run-file.h"
+
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace hst {
+
+namespace {
+
+void
+io_error(const std::string& what)
+{
+    std::perror(what.c_str());
+    std::exit(EXIT_FAILURE);
+}
+
+}  // namespace
+
+RunFile::RunFile(const std::string& directory)
+{
+    std::string path = directory;
+    if (path.empty()) {
+        const char* tmpdir = std::getenv("TMPDIR");
+        path = tmpdir != nullptr && *tmpdir != '\0' ? tmpdir : "/tmp";
+    }
+    path += "/hst-run-XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    int fd = mkstemp(name.data());
+    if (fd == -1) {
+        io_error("Cannot create run file in " + path);
+    }
+    unlink(name.data());
+    file_ = fdopen(fd, "w+b");
+    if (file_ == nullptr) {
+        io_error("Cannot open run file");
+    }
+    runs_.push_back(Run{0, 0});
+}
+
+RunFile::~RunFile()
+{
+    std::fclose(file_);
+}
+
+void
+RunFile::put(int byte)
+{
+    // A failed write anywhere within a value would corrupt the rest of the
+    // run, so we check every byte.
+    if (std::putc(byte, file_) == EOF) {
+        io_error("Cannot write run file");
+    }
+}
+
+void
+RunFile::append(std::uint64_t value)
+{
+    // Each value is stored as the difference from the previous one, 7 bits at a
+    // time, starting with the least significant bits.  The high bit of each
+    // byte is set if there are more bytes to come.
+    std::uint64_t delta = value - last_;
+    last_ = value;
+    runs_.back().size++;
+    while (delta >= 0x80) {
+        put(static_cast<int>((delta & 0x7f) | 0x80));
+        delta >>= 7;
+    }
+    put(static_cast<int>(delta));
+}
+
+void
+RunFile::finish()
+{
+    if (std::fflush(file_) != 0) {
+        io_error("Cannot write run file");
+    }
+    rewind(runs_.size() - 1);
+}
+
+void
+RunFile::start_run()
+{
+    if (std::fseek(file_, 0, SEEK_END) != 0) {
+        io_error("Cannot seek in run file");
+    }
+    long offset = std::ftell(file_);
+    if (offset == -1) {
+        io_error("Cannot seek in run file");
+    }
+    runs_.push_back(Run{offset, 0});
+    current_ = runs_.size() - 1;
+    last_ = 0;
+}
+
+void
+RunFile::rewind(std::size_t run)
+{
+    if (std::fseek(file_, runs_[run].offset, SEEK_SET) != 0) {
+        io_error("Cannot seek in run file");
+    }
+    current_ = run;
+    read_ = 0;
+    last_ = 0;
+}
+
+bool
+RunFile::next(std::uint64_t* value)
+{
+    if (read_ == runs_[current_].size) {
+        return false;
+    }
+    std::uint64_t delta = 0;
+    for (unsigned int shift = 0;; shift += 7) {
+        int byte = std::getc(file_);
+        if (byte == EOF) {
+            io_error("Cannot read run file");
+        }
+        delta |= std::uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    last_ += delta;
+    read_++;
+    *value = last_;
+    return true;
+}
+
+}  // namespace hst
@@ -0,0 +1,92 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef HST_RUN_FILE_H
+#define HST_RUN_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace hst {
+
+// A temporary file on disk that holds a sorted run of distinct 64-bit values.
+// We only store the difference between each value and the one before it, as a
+// variable-length integer, so a run of densely packed values takes up much less
+// space than 8 bytes per value.
+//
+// You first append all of the values, in strictly increasing order, and then
+// call finish(), after which you can read them back (as many times as you
+// want) in the same order.  The file is removed from the filesystem as soon as
+// we create it, so the space is reclaimed automatically when the RunFile is
+// destroyed, or if the process crashes.
+//
+// A single file can also hold several runs, one after another.  Call
+// start_run() to begin appending a new run at the end of the file; after
+// you've finished it, you can use rewind(run) to read back any of the runs in
+// the file.  That lets you keep many runs around using a single file
+// descriptor.
+//
+// We can't recover from an I/O error in the middle of a search, so if we can't
+// create, write, or read the file, we print an error message and exit.
+class RunFile {
+  public:
+    // Creates a new empty run in `directory`.  If `directory` is empty, we use
+    // $TMPDIR, or /tmp if that isn't set.
+    explicit RunFile(const std::string& directory);
+    RunFile(const RunFile& other) = delete;
+    RunFile& operator=(const RunFile& other) = delete;
+    ~RunFile();
+
+    // The number of values in the current run.
+    std::size_t size() const { return runs_[current_].size; }
+
+    // The number of runs in the file.
+    std::size_t run_count() const { return runs_.size(); }
+
+    // Adds a value to the end of the last run.  `value` must be larger than
+    // any value that you've already added to that run.
+    void append(std::uint64_t value);
+
+    // Finishes writing the last run, and prepares to read it from the
+    // beginning.
+    void finish();
+
+    // Starts a new, empty run at the end of the file.  The previous run must
+    // have been finished.
+    void start_run();
+
+    // Starts reading the current run from the beginning again.
+    void rewind() { rewind(current_); }
+
+    // Starts reading the given run (counting from 0) from the beginning.
+    void rewind(std::size_t run);
+
+    // Reads the next value from the current run, returning false if there
+    // aren't any more.
+    bool next(std::uint64_t* value);
+
+  private:
+    struct Run {
+        long offset;
+        std::size_t size;
+    };
+
+    // Writes a single byte, exiting if the write fails.
+    void put(int byte);
+
+    std::FILE* file_;
+    std::vector<Run> runs_;
+    std::size_t current_ = 0;
+    std::size_t read_ = 0;
+    std::uint64_t last_ = 0;
+};
+
+}  // namespace hst
+#endif  // HST_RUN_FILE_H
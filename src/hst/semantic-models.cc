@@ -8,7 +8,11 @@
 #include "hst/semantic-models.h"
 
 #include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
 
+#include "hst/environment.h"
 #include "hst/event.h"
 #include "hst/hash.h"
 #include "hst/process.h"
@@ -54,8 +58,7 @@ Traces::get_process_behavior(const Process::Set& processes)
 bool
 Traces::Behavior::refined_by(const Behavior& impl) const
 {
-    return std::includes(events_.begin(), events_.end(), impl.events_.begin(),
-                         impl.events_.end());
+    return impl.events_.is_subset_of(events_);
 }
 
 bool
@@ -64,4 +67,220 @@ Traces::Behavior::operator==(const Behavior& other) const
     return events_ == other.events_;
 }
 
+std::ostream&
+operator<<(std::ostream& out, const Traces::Behavior& behavior)
+{
+    return out << behavior.events();
+}
+
+//------------------------------------------------------------------------------
+// Stable failures
+
+Failures::Behavior
+Failures::get_process_behavior(const Process& process)
+{
+    Behavior behavior;
+    const NormalizedProcess* normalized =
+            dynamic_cast<const NormalizedProcess*>(&process);
+    if (normalized) {
+        normalized->expand([&behavior](const Process& member) {
+            behavior.add(member);
+        });
+    } else {
+        behavior.add(process);
+    }
+    return behavior;
+}
+
+Failures::Behavior
+Failures::get_process_behavior(const Process::Set& processes)
+{
+    Behavior behavior;
+    for (const Process* process : processes) {
+        behavior.add(*process);
+    }
+    return behavior;
+}
+
+void
+Failures::Behavior::add(const Process& process)
+{
+    Event::Set initials;
+    process.initials(&initials);
+    bool stable = initials.erase(Event::tau()) == 0;
+    initials_.insert(initials.begin(), initials.end());
+    if (stable) {
+        add_acceptance(std::move(initials));
+    }
+}
+
+void
+Failures::Behavior::add_acceptance(Event::Set acceptance)
+{
+    // If we already have a smaller acceptance, this one is redundant.
+    for (const Event::Set& existing : acceptances_) {
+        if (existing.is_subset_of(acceptance)) {
+            return;
+        }
+    }
+    // Otherwise, it makes any larger acceptances redundant.
+    auto redundant = [&acceptance](const Event::Set& existing) {
+        return acceptance.is_subset_of(existing);
+    };
+    acceptances_.erase(std::remove_if(acceptances_.begin(), acceptances_.end(),
+                                      redundant),
+                       acceptances_.end());
+    acceptances_.push_back(std::move(acceptance));
+}
+
+bool
+Failures::Behavior::refined_by(const Behavior& impl) const
+{
+    if (!impl.initials_.is_subset_of(initials_)) {
+        return false;
+    }
+    for (const Event::Set& impl_acceptance : impl.acceptances_) {
+        bool matched = std::any_of(
+                acceptances_.begin(), acceptances_.end(),
+                [&impl_acceptance](const Event::Set& acceptance) {
+                    return acceptance.is_subset_of(impl_acceptance);
+                });
+        if (!matched) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool
+Failures::Behavior::operator==(const Behavior& other) const
+{
+    // Antichains never contain duplicates, so they're equal if they're the
+    // same size and every element of one is in the other.
+    if (initials_ != other.initials_ ||
+        acceptances_.size() != other.acceptances_.size()) {
+        return false;
+    }
+    for (const Event::Set& acceptance : acceptances_) {
+        if (std::find(other.acceptances_.begin(), other.acceptances_.end(),
+                      acceptance) == other.acceptances_.end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::size_t
+Failures::Behavior::hash() const
+{
+    static hash_scope failures;
+    unordered_hasher acceptances;
+    for (const Event::Set& acceptance : acceptances_) {
+        acceptances.add(acceptance);
+    }
+    return hasher(failures).add(initials_).add(acceptances.value()).value();
+}
+
+std::ostream&
+operator<<(std::ostream& out, const Failures::Behavior& behavior)
+{
+    // Print the acceptances in a consistent order.
+    std::vector<std::string> acceptances;
+    for (const Event::Set& acceptance : behavior.acceptances()) {
+        std::stringstream rendered;
+        rendered << acceptance;
+        acceptances.push_back(rendered.str());
+    }
+    std::sort(acceptances.begin(), acceptances.end());
+    out << behavior.initials() << " accepting {";
+    bool first = true;
+    for (const std::string& acceptance : acceptances) {
+        if (first) {
+            first = false;
+        } else {
+            out << ", ";
+        }
+        out << acceptance;
+    }
+    return out << "}";
+}
+
+//------------------------------------------------------------------------------
+// Failures-divergences
+
+FailuresDivergences::Behavior
+FailuresDivergences::get_process_behavior(const Process& process)
+{
+    Behavior behavior;
+    const NormalizedProcess* normalized =
+            dynamic_cast<const NormalizedProcess*>(&process);
+    if (normalized) {
+        normalized->expand([&behavior](const Process& member) {
+            behavior.add(member);
+        });
+    } else {
+        behavior.add(process);
+    }
+    return behavior;
+}
+
+FailuresDivergences::Behavior
+FailuresDivergences::get_process_behavior(const Process::Set& processes)
+{
+    Behavior behavior;
+    for (const Process* process : processes) {
+        behavior.add(*process);
+    }
+    return behavior;
+}
+
+void
+FailuresDivergences::Behavior::add(const Process& process)
+{
+    failures_.add(process);
+    if (!divergent_) {
+        divergent_ = process.environment()->diverges(process);
+    }
+}
+
+bool
+FailuresDivergences::Behavior::refined_by(const Behavior& impl) const
+{
+    if (divergent_) {
+        return true;
+    }
+    if (impl.divergent_) {
+        return false;
+    }
+    return failures_.refined_by(impl.failures_);
+}
+
+bool
+FailuresDivergences::Behavior::operator==(const Behavior& other) const
+{
+    if (divergent_ || other.divergent_) {
+        return divergent_ == other.divergent_;
+    }
+    return failures_ == other.failures_;
+}
+
+std::size_t
+FailuresDivergences::Behavior::hash() const
+{
+    static hash_scope divergent;
+    if (divergent_) {
+        return hasher(divergent).value();
+    }
+    return failures_.hash();
+}
+
+std::ostream&
+operator<<(std::ostream& out, const FailuresDivergences::Behavior& behavior)
+{
+    if (behavior.divergent()) {
+        return out << "divergent";
+    }
+    return out << behavior.failures();
+}
+
 }  // namespace hst
@@ -106,6 +106,97 @@ class Traces::Behavior {
     Event::Set events_;
 };
 
+std::ostream&
+operator<<(std::ostream& out, const Traces::Behavior& behavior);
+
+struct Failures {
+    // In the stable failures model, the behavior of a process is the set of
+    // non-τ events that it can perform, along with the acceptance (the set of
+    // initial events) of each of its stable states.  A process that can accept
+    // some set of events can also accept any superset of it, so we only keep
+    // the minimal acceptances.
+    //
+    // The behavior of a normalized process is the behavior of the set of
+    // processes that it represents.
+    class Behavior;
+
+    static const char* abbreviation() { return "F"; }
+    static const char* name() { return "failures"; }
+    static Behavior get_process_behavior(const Process& process);
+    static Behavior get_process_behavior(const Process::Set& processes);
+};
+
+class Failures::Behavior {
+  public:
+    Behavior() = default;
+
+    // Adds the behavior of a single process.  If `process` can perform a τ,
+    // it's not stable, so it doesn't contribute an acceptance.
+    void add(const Process& process);
+
+    const Event::Set& initials() const { return initials_; }
+
+    // The minimal acceptances, which form an antichain: none of them is a
+    // subset of any other.  They're in no particular order.
+    const std::vector<Event::Set>& acceptances() const { return acceptances_; }
+
+    // Impl refines Spec if every event that Impl can perform is one that Spec
+    // can perform, and every acceptance of Impl is a superset of some
+    // acceptance of Spec.  (That is, Impl can only refuse the events that Spec
+    // can refuse.)
+    bool refined_by(const Behavior& impl) const;
+
+    bool operator==(const Behavior& other) const;
+    bool operator!=(const Behavior& other) const { return !(*this == other); }
+    std::size_t hash() const;
+
+  private:
+    void add_acceptance(Event::Set acceptance);
+
+    Event::Set initials_;
+    std::vector<Event::Set> acceptances_;
+};
+
+std::ostream&
+operator<<(std::ostream& out, const Failures::Behavior& behavior);
+
+struct FailuresDivergences {
+    // In the failures-divergences model, the behavior of a process is its
+    // stable failures behavior, along with whether it can diverge.  A process
+    // that can diverge might do anything at all, so all divergent behaviors are
+    // equivalent, and a divergent Spec is refined by every Impl.
+    class Behavior;
+
+    static const char* abbreviation() { return "FD"; }
+    static const char* name() { return "failures-divergences"; }
+    static Behavior get_process_behavior(const Process& process);
+    static Behavior get_process_behavior(const Process::Set& processes);
+};
+
+class FailuresDivergences::Behavior {
+  public:
+    Behavior() = default;
+
+    // Adds the behavior of a single process.
+    void add(const Process& process);
+
+    const Failures::Behavior& failures() const { return failures_; }
+    bool divergent() const { return divergent_; }
+
+    bool refined_by(const Behavior& impl) const;
+
+    bool operator==(const Behavior& other) const;
+    bool operator!=(const Behavior& other) const { return !(*this == other); }
+    std::size_t hash() const;
+
+  private:
+    Failures::Behavior failures_;
+    bool divergent_ = false;
+};
+
+std::ostream&
+operator<<(std::ostream& out, const FailuresDivergences::Behavior& behavior);
+
 }  // namespace hst
 
 namespace std {
@@ -119,6 +210,25 @@ struct hash<hst::Traces::Behavior>
     }
 };
 
+template <>
+struct hash<hst::Failures::Behavior>
+{
+    std::size_t operator()(const hst::Failures::Behavior& behavior) const
+    {
+        return behavior.hash();
+    }
+};
+
+template <>
+struct hash<hst::FailuresDivergences::Behavior>
+{
+    std::size_t
+    operator()(const hst::FailuresDivergences::Behavior& behavior) const
+    {
+        return behavior.hash();
+    }
+};
+
 }  // namespace std
 
 //------------------------------------------------------------------------------
@@ -7,11 +7,11 @@
 
 #include "hst/environment.h"
 
-#include <functional>
 #include <memory>
 #include <ostream>
 
 #include "hst/event.h"
+#include "hst/function-ref.h"
 #include "hst/hash.h"
 #include "hst/process.h"
 
@@ -26,12 +26,12 @@ class SequentialComposition : public Process {
     {
     }
 
-    void initials(std::function<void(Event)> op) const override;
+    void initials(function_ref<void(Event)> op) const override;
     void afters(Event initial,
-                std::function<void(const Process&)> op) const override;
-    void subprocesses(std::function<void(const Process&)> op) const override;
+                function_ref<void(const Process&)> op) const override;
+    void subprocesses(function_ref<void(const Process&)> op) const override;
 
-    std::size_t hash() const override;
+    std::size_t compute_hash() const override;
     bool operator==(const Process& other) const override;
     unsigned int precedence() const override { return 3; }
     void print(std::ostream& out) const override;
@@ -47,7 +47,7 @@ class SequentialComposition : public Process {
 const Process*
 Environment::sequential_composition(const Process* p, const Process* q)
 {
-    return register_process(new SequentialComposition(this, p, q));
+    return register_process<SequentialComposition>(this, p, q);
 }
 
 // Operational semantics for P ; Q
@@ -61,7 +61,7 @@ Environment::sequential_composition(const Process* p, const Process* q)
 //       P;Q -τ→ Q
 
 void
-SequentialComposition::initials(std::function<void(Event)> op) const
+SequentialComposition::initials(function_ref<void(Event)> op) const
 {
     // 1) P;Q can perform all of the same events as P, except for ✔.
     // 2) If P can perform ✔, then P;Q can perform τ.
@@ -79,7 +79,7 @@ SequentialComposition::initials(std::function<void(Event)> op) const
 
 void
 SequentialComposition::afters(Event initial,
-                              std::function<void(const Process&)> op) const
+                              function_ref<void(const Process&)> op) const
 {
     // afters(P;Q a ≠ ✔) = afters(P, a)                                 [rule 1]
     // afters(P;Q, τ) = Q  if ✔ ∈ initials(P)                           [rule 2]
@@ -104,7 +104,6 @@ SequentialComposition::afters(Event initial,
     // Q.  Note that we don't care what P' is; we just care that it exists.
     if (initial == Event::tau()) {
         bool any_ticks = false;
-        Process::Set afters;
         p_->afters(Event::tick(),
                    [&any_ticks](const Process& _) { any_ticks = true; });
         if (any_ticks) {
@@ -117,14 +116,14 @@ SequentialComposition::afters(Event initial,
 
 void
 SequentialComposition::subprocesses(
-        std::function<void(const Process&)> op) const
+        function_ref<void(const Process&)> op) const
 {
     op(*p_);
     op(*q_);
 }
 
 std::size_t
-SequentialComposition::hash() const
+SequentialComposition::compute_hash() const
 {
     static hash_scope sequential_composition;
     return hasher(sequential_composition).add(*p_).add(*q_).value();
@@ -138,7 +137,7 @@ SequentialComposition::operator==(const Process& other_) const
     if (other == nullptr) {
         return false;
     }
-    return *p_ == *other->p_ && *q_ == *other->q_;
+    return p_ == other->p_ && q_ == other->q_;
 }
 
 void
@@ -0,0 +1,105 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "hst/subset-table.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "hst/hash.h"
+#include "hst/process.h"
+
+namespace hst {
+
+SubsetTable::SubsetTable() : slots_(64, Slot{0, 0, false}) {}
+
+std::size_t
+SubsetTable::hash(const std::vector<Process::Index>& indices)
+{
+    static hash_scope subset;
+    hst::hasher hash(subset);
+    for (Process::Index index : indices) {
+        hash.add(index);
+    }
+    return hash.value();
+}
+
+const Process::Index*
+SubsetTable::store(const std::vector<Process::Index>& indices)
+{
+    std::size_t size = indices.size();
+    if (size == 0) {
+        return nullptr;
+    }
+    // Sets that are too large to share a slab get one of their own.
+    if (size > slab_size / 4) {
+        large_.emplace_back(new Process::Index[size]);
+        Process::Index* result = large_.back().get();
+        std::copy(indices.begin(), indices.end(), result);
+        return result;
+    }
+    if (slab_used_ + size > slab_size) {
+        slabs_.emplace_back(new Process::Index[slab_size]);
+        slab_used_ = 0;
+    }
+    Process::Index* result = slabs_.back().get() + slab_used_;
+    std::copy(indices.begin(), indices.end(), result);
+    slab_used_ += size;
+    return result;
+}
+
+SubsetTable::ID
+SubsetTable::intern(const std::vector<Process::Index>& indices)
+{
+    std::size_t hash = SubsetTable::hash(indices);
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t mask = slots_.size() - 1;
+    std::size_t i = hash & mask;
+    for (; slots_[i].used; i = (i + 1) & mask) {
+        if (slots_[i].hash == hash) {
+            const Subset& existing = subsets_[slots_[i].id];
+            if (existing.size == indices.size() &&
+                std::equal(indices.begin(), indices.end(), existing.begin)) {
+                return slots_[i].id;
+            }
+        }
+    }
+
+    ID id = next_id_++;
+    Subset& subset = subsets_.slot(id);
+    subset.begin = store(indices);
+    subset.size = indices.size();
+    subset.hash = hash;
+    slots_[i] = Slot{hash, id, true};
+    // Keep the table at most half full, so that probe sequences stay short.
+    if (std::size_t(next_id_) * 2 > slots_.size()) {
+        grow();
+    }
+    return id;
+}
+
+void
+SubsetTable::grow()
+{
+    std::vector<Slot> old_slots(slots_.size() * 2, Slot{0, 0, false});
+    std::swap(slots_, old_slots);
+    std::size_t mask = slots_.size() - 1;
+    for (const Slot& slot : old_slots) {
+        if (slot.used) {
+            std::size_t i = slot.hash & mask;
+            while (slots_[i].used) {
+                i = (i + 1) & mask;
+            }
+            slots_[i] = slot;
+        }
+    }
+}
+
+}  // namespace hst
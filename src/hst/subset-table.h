@@ -0,0 +1,93 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef HST_SUBSET_TABLE_H
+#define HST_SUBSET_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "hst/chunked-array.h"
+#include "hst/process.h"
+
+namespace hst {
+
+// Interns sets of processes, each represented as a sorted array of process
+// indices.  Each distinct set is stored exactly once, and gets a dense ID; two
+// sets are equal if and only if they have the same ID.  The arrays themselves
+// are packed into large shared slabs, and we precompute the hash of each set
+// when we intern it.
+//
+// This class is safe to use from multiple threads.
+class SubsetTable {
+  public:
+    using ID = std::uint32_t;
+
+    // The members of an interned set, in increasing order of their indices.
+    class Members {
+      public:
+        Members(const Process::Index* begin, std::uint32_t size)
+            : begin_(begin), size_(size)
+        {
+        }
+
+        const Process::Index* begin() const { return begin_; }
+        const Process::Index* end() const { return begin_ + size_; }
+        std::size_t size() const { return size_; }
+
+      private:
+        const Process::Index* begin_;
+        std::uint32_t size_;
+    };
+
+    SubsetTable();
+
+    // Returns the ID of the set whose members are `indices`, which must be
+    // sorted and must not contain any duplicates.
+    ID intern(const std::vector<Process::Index>& indices);
+
+    Members members(ID id) const
+    {
+        const Subset& subset = subsets_[id];
+        return Members(subset.begin, subset.size);
+    }
+
+    std::size_t hash(ID id) const { return subsets_[id].hash; }
+
+  private:
+    struct Subset {
+        const Process::Index* begin;
+        std::uint32_t size;
+        std::size_t hash;
+    };
+
+    struct Slot {
+        std::size_t hash;
+        ID id;  // only meaningful if `used` is true
+        bool used;
+    };
+
+    static std::size_t hash(const std::vector<Process::Index>& indices);
+    const Process::Index* store(const std::vector<Process::Index>& indices);
+    void grow();
+
+    static const std::size_t slab_size = 1 << 16;
+
+    std::mutex mutex_;
+    ChunkedArray<Subset> subsets_;
+    std::vector<Slot> slots_;
+    std::vector<std::unique_ptr<Process::Index[]>> slabs_;
+    std::size_t slab_used_ = slab_size;
+    std::vector<std::unique_ptr<Process::Index[]>> large_;
+    ID next_id_ = 0;
+};
+
+}  // namespace hst
+#endif  // HST_SUBSET_TABLE_H
@@ -0,0 +1,194 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "hst/tau-closure-cache.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "hst/event.h"
+#include "hst/process.h"
+
+namespace hst {
+
+const TauClosureCache::Component*
+TauClosureCache::find(const Process& process)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Process::Index index = process.index();
+    return index < components_.size() ? components_[index] : nullptr;
+}
+
+void
+TauClosureCache::publish(std::unique_ptr<Component> component)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const Process* member : component->members) {
+        Process::Index index = member->index();
+        if (index >= components_.size()) {
+            components_.resize(index + 1, nullptr);
+        }
+        // Another thread might have gotten here first; if so, we keep its
+        // component, which will have the same contents as ours.
+        if (components_[index] == nullptr) {
+            components_[index] = component.get();
+        }
+    }
+    owned_.push_back(std::move(component));
+}
+
+const TauClosureCache::Component&
+TauClosureCache::component(const Process& process)
+{
+    const Component* cached = find(process);
+    if (cached) {
+        return *cached;
+    }
+
+    // An iterative version of Tarjan's algorithm, so that long τ-chains can't
+    // overflow the call stack.  We don't hold our lock while we search, since
+    // calculating τ-afters can register new processes.
+    struct Node {
+        std::size_t index;
+        std::size_t lowlink;
+        bool on_stack;
+        std::vector<const Process*> successors;
+    };
+    struct Frame {
+        const Process* process;
+        std::size_t next_successor;
+    };
+
+    Event tau = Event::tau();
+    std::unordered_map<const Process*, Node> nodes;
+    std::vector<Frame> frames;
+    std::vector<const Process*> stack;
+
+    auto visit = [&](const Process* process) {
+        std::size_t index = nodes.size();
+        Node& node = nodes[process];
+        node.index = node.lowlink = index;
+        node.on_stack = true;
+        process->transitions(tau, [&node](const Process& after) {
+            node.successors.push_back(&after);
+        });
+        stack.push_back(process);
+        frames.push_back(Frame{process, 0});
+    };
+
+    visit(&process);
+    while (!frames.empty()) {
+        Frame& frame = frames.back();
+        Node& node = nodes[frame.process];
+        if (frame.next_successor < node.successors.size()) {
+            const Process* successor = node.successors[frame.next_successor++];
+            auto it = nodes.find(successor);
+            if (it != nodes.end()) {
+                if (it->second.on_stack) {
+                    node.lowlink = std::min(node.lowlink, it->second.index);
+                }
+            } else if (!find(*successor)) {
+                visit(successor);
+            }
+            continue;
+        }
+
+        // We've visited everything reachable from this process.  If it's the
+        // root of a component, pop the component off of the stack; all of its
+        // successor components have already been published, so we can link to
+        // them (and decide whether it diverges) without looking any further.
+        if (node.lowlink == node.index) {
+            std::unique_ptr<Component> component(new Component);
+            const Process* member;
+            do {
+                member = stack.back();
+                stack.pop_back();
+                nodes[member].on_stack = false;
+                component->members.push_back(member);
+            } while (member != frame.process);
+
+            component->divergent = component->members.size() > 1;
+            for (const Process* member : component->members) {
+                for (const Process* successor : nodes[member].successors) {
+                    if (successor == member) {
+                        component->divergent = true;
+                        continue;
+                    }
+                    const Component* next = find(*successor);
+                    if (next == nullptr) {
+                        // Not yet published, so it's in this component.
+                        continue;
+                    }
+                    component->successors.push_back(next);
+                    component->divergent |= next->divergent;
+                }
+            }
+            std::sort(component->successors.begin(),
+                      component->successors.end());
+            component->successors.erase(
+                    std::unique(component->successors.begin(),
+                                component->successors.end()),
+                    component->successors.end());
+            publish(std::move(component));
+        }
+
+        std::size_t lowlink = node.lowlink;
+        frames.pop_back();
+        if (!frames.empty()) {
+            Node& parent = nodes[frames.back().process];
+            parent.lowlink = std::min(parent.lowlink, lowlink);
+        }
+    }
+
+    return *find(process);
+}
+
+const Process::Set&
+TauClosureCache::closure(const Process& process)
+{
+    const Component& root = component(process);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (root.closure) {
+        return *root.closure;
+    }
+
+    // Collect the members of every component reachable from this one.  If we
+    // reach a component whose closure we've already built, we can take all of
+    // it at once without visiting its successors.
+    std::unique_ptr<Process::Set> closure(new Process::Set);
+    std::unordered_set<const Component*> seen{&root};
+    std::vector<const Component*> queue{&root};
+    while (!queue.empty()) {
+        const Component* current = queue.back();
+        queue.pop_back();
+        if (current != &root && current->closure) {
+            closure->insert(current->closure->begin(),
+                            current->closure->end());
+            continue;
+        }
+        closure->insert(current->members.begin(), current->members.end());
+        for (const Component* next : current->successors) {
+            if (seen.insert(next).second) {
+                queue.push_back(next);
+            }
+        }
+    }
+
+    // We hold the lock, so nobody else can have filled this in while we were
+    // building it.
+    Component& mutable_root = *components_[process.index()];
+    mutable_root.closure = std::move(closure);
+    return *mutable_root.closure;
+}
+
+}  // namespace hst
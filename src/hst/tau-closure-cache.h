@@ -0,0 +1,77 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef HST_TAU_CLOSURE_CACHE_H
+#define HST_TAU_CLOSURE_CACHE_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "hst/process.h"
+
+namespace hst {
+
+// Remembers the τ-closure of every process that we've asked about so far.
+//
+// The first time you ask about a process, we find the strongly connected
+// components of the τ-graph reachable from it (using Tarjan's algorithm), and
+// link each component to its successor components.  The same pass tells us
+// which processes can diverge: a component that contains a τ-cycle (because it
+// has more than one member, or because its only member has a τ-transition to
+// itself) is divergent, and so is any component that can reach a divergent
+// one.  That only needs one bit per component, so the pass is linear in the
+// size of the τ-graph.
+//
+// We only build a component's closure once someone asks for it, by walking
+// the component graph below it.  Every process in a component has the same
+// closure, so they all share a single Process::Set.
+//
+// This class is safe to use from multiple threads.
+class TauClosureCache {
+  public:
+    TauClosureCache() = default;
+
+    // Returns the τ-closure of `process`.  (That is, `process` itself, plus any
+    // process you can reach from it by following τ one or more times.)
+    const Process::Set& closure(const Process& process);
+
+    // Returns whether `process` can diverge — that is, whether it can perform
+    // an infinite sequence of τ events.
+    bool diverges(const Process& process)
+    {
+        return component(process).divergent;
+    }
+
+  private:
+    struct Component {
+        std::vector<const Process*> members;
+        std::vector<const Component*> successors;
+        bool divergent;
+        // Only filled in once someone asks for it.
+        std::unique_ptr<Process::Set> closure;
+    };
+
+    // Returns the component containing `process`, calculating it (and any
+    // components reachable from it) if needed.
+    const Component& component(const Process& process);
+
+    // Returns the component containing `process`, or nullptr if we haven't
+    // calculated it yet.
+    const Component* find(const Process& process);
+
+    // Records that `component` contains each of its members.
+    void publish(std::unique_ptr<Component> component);
+
+    std::mutex mutex_;
+    // Indexed by Process::index().
+    std::vector<Component*> components_;
+    std::vector<std::unique_ptr<Component>> owned_;
+};
+
+}  // namespace hst
+#endif  // HST_TAU_CLOSURE_CACHE_H
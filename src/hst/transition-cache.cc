@@ -0,0 +1,102 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "hst/transition-cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "hst/environment.h"
+#include "hst/event.h"
+#include "hst/function-ref.h"
+#include "hst/process.h"
+
+namespace hst {
+
+const TransitionCache::Row&
+TransitionCache::row(const Process& process)
+{
+    Process::Index index = process.index();
+    if (index < filled_.size() && filled_[index]) {
+        return rows_[index];
+    }
+
+    // Calculate the transitions from the operational semantics.  We do this
+    // before touching any of our own fields, since calculating the afters of a
+    // process might register new processes, or even fill in the rows of other
+    // processes (a prenormalized process finds its afters via the transitions
+    // of its members).  So we collect this row in a local buffer, and only
+    // append it to the table once all of those nested calls have returned.
+    Event::Set initials;
+    process.initials(&initials);
+    std::vector<std::pair<Event, Process::Index>> transitions;
+    for (Event initial : initials) {
+        process.afters(initial, [initial, &transitions](const Process& after) {
+            transitions.push_back(std::make_pair(initial, after.index()));
+        });
+    }
+    std::sort(transitions.begin(), transitions.end());
+    transitions.erase(std::unique(transitions.begin(), transitions.end()),
+                      transitions.end());
+
+    std::uint32_t begin = events_.size();
+    for (const auto& transition : transitions) {
+        events_.push_back(transition.first);
+        targets_.push_back(transition.second);
+    }
+    std::uint32_t end = events_.size();
+
+    if (index >= rows_.size()) {
+        rows_.resize(index + 1);
+        filled_.resize(index + 1);
+    }
+    rows_[index] = Row{begin, end};
+    filled_[index] = true;
+    return rows_[index];
+}
+
+void
+TransitionCache::transitions(const Process& process,
+                             function_ref<void(Event, const Process&)> op)
+{
+    Row r = row(process);
+    for (std::uint32_t i = r.begin; i < r.end; i++) {
+        op(events_[i], *env_->process(targets_[i]));
+    }
+}
+
+void
+TransitionCache::initials(const Process& process, Event::Set* out)
+{
+    // The row is sorted by event, so each event's transitions are adjacent.
+    Row r = row(process);
+    for (std::uint32_t i = r.begin; i < r.end; i++) {
+        if (i == r.begin || events_[i] != events_[i - 1]) {
+            out->insert(events_[i]);
+        }
+    }
+}
+
+void
+TransitionCache::afters(const Process& process, Event initial,
+                        function_ref<void(const Process&)> op)
+{
+    // `op` might fill in new rows, which can reallocate `events_`, so we hold
+    // onto offsets instead of iterators.
+    Row r = row(process);
+    auto range = std::equal_range(events_.begin() + r.begin,
+                                  events_.begin() + r.end, initial);
+    std::uint32_t begin = range.first - events_.begin();
+    std::uint32_t end = range.second - events_.begin();
+    for (std::uint32_t i = begin; i < end; i++) {
+        op(*env_->process(targets_[i]));
+    }
+}
+
+}  // namespace hst
@@ -0,0 +1,62 @@
+/* -*- coding: utf-8 -*-
+ * -----------------------------------------------------------------------------
+ * Copyright © 2017, HST Project.
+ * Please see the COPYING file in this distribution for license details.
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef HST_TRANSITION_CACHE_H
+#define HST_TRANSITION_CACHE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "hst/event.h"
+#include "hst/function-ref.h"
+#include "hst/process.h"
+
+namespace hst {
+
+class Environment;
+
+// An explicit copy of the labeled transition system of every process that
+// we've asked about so far.  The first time you ask for the transitions of a
+// process, we calculate them from the process's operational semantics, and
+// record them in a compressed sparse row table indexed by Process::index().
+// Every later request reads them back out of that table.
+//
+// Each row is sorted by event, and then by the index of the target process, and
+// contains no duplicates.
+class TransitionCache {
+  public:
+    explicit TransitionCache(const Environment* env) : env_(env) {}
+
+    // Calls `op` for each outgoing transition of `process`.
+    void transitions(const Process& process,
+                     function_ref<void(Event, const Process&)> op);
+
+    // Adds each event that `process` has an outgoing transition for to `out`.
+    void initials(const Process& process, Event::Set* out);
+
+    // Calls `op` for each process that `process` can reach by following a
+    // single `initial` event.
+    void afters(const Process& process, Event initial,
+                function_ref<void(const Process&)> op);
+
+  private:
+    struct Row {
+        std::uint32_t begin;
+        std::uint32_t end;
+    };
+
+    const Row& row(const Process& process);
+
+    const Environment* env_;
+    std::vector<Row> rows_;
+    std::vector<bool> filled_;
+    std::vector<Event> events_;
+    std::vector<Process::Index> targets_;
+};
+
+}  // namespace hst
+#endif  // HST_TRANSITION_CACHE_H
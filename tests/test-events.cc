@@ -5,6 +5,10 @@
  * -----------------------------------------------------------------------------
  */
 
+#include <set>
+#include <string>
+#include <vector>
+
 #include "test-cases.h"
 #include "test-harness.cc.in"
 
@@ -30,3 +34,162 @@ TEST_CASE("events are interned")
     Event a2("a");
     check_eq(a1, a2);
 }
+
+TEST_CASE("can look up event names")
+{
+    Event a("a");
+    check_eq(a.name(), std::string("a"));
+    check_eq(Event::tau().name(), std::string("τ"));
+    check_eq(Event::tick().name(), std::string("✔"));
+    check_eq(Event("τ"), Event::tau());
+    check_eq(Event("✔"), Event::tick());
+}
+
+TEST_CASE("can create events from unterminated names")
+{
+    const char* names = "abcdef";
+    check_eq(Event(names, 3), Event("abc"));
+    check_eq(Event(names + 3, 3), Event("def"));
+    check_ne(Event(names, 3), Event(names, 4));
+}
+
+TEST_CASE("lots of events are interned")
+{
+    std::vector<Event> events;
+    for (unsigned int i = 0; i < 10000; i++) {
+        events.push_back(Event("many" + std::to_string(i)));
+    }
+    for (unsigned int i = 0; i < 10000; i++) {
+        std::string name = "many" + std::to_string(i);
+        check_eq(Event(name), events[i]);
+        check_eq(events[i].name(), name);
+    }
+}
+
+TEST_CASE_GROUP("event sets");
+
+namespace {
+
+// Returns a set containing the events named `prefix0` through `prefix{n-1}`,
+// added in reverse order.
+Event::Set
+numbered_events(const std::string& prefix, unsigned int n)
+{
+    Event::Set set;
+    for (unsigned int i = n; i-- > 0;) {
+        set.insert(Event(prefix + std::to_string(i)));
+    }
+    return set;
+}
+
+}  // namespace
+
+TEST_CASE("event sets iterate in order")
+{
+    // 3 events fit inline; 100 need a bitset.
+    for (unsigned int n : {3, 100}) {
+        // Events are ordered by when they were first created, so create them
+        // all before adding them to the set in a different order.
+        std::vector<Event> expected;
+        for (unsigned int i = 0; i < n; i++) {
+            expected.push_back(Event("order" + std::to_string(n) + "-" +
+                                     std::to_string(i)));
+        }
+        Event::Set set(expected.rbegin(), expected.rend());
+        check_eq(set.size(), Event::Set::size_type(n));
+        Event::Set::const_iterator it = set.begin();
+        for (const Event event : expected) {
+            check_eq(*it++, event);
+        }
+        check_eq(it == set.end(), true);
+    }
+}
+
+TEST_CASE("small and large event sets compare equal")
+{
+    Event::Set large = numbered_events("eq", 100);
+    Event::Set small;
+    for (unsigned int i = 0; i < 100; i++) {
+        if (i != 7 && i != 42) {
+            check_eq(large.erase(Event("eq" + std::to_string(i))),
+                     Event::Set::size_type(1));
+        }
+    }
+    small.insert(Event("eq42"));
+    small.insert(Event("eq7"));
+    check_eq(large.size(), Event::Set::size_type(2));
+    check_eq(large, small);
+    check_eq(large.hash(), small.hash());
+    check_eq(large.contains(Event("eq7")), true);
+    check_eq(large.contains(Event("eq8")), false);
+}
+
+TEST_CASE("event set subsets")
+{
+    Event::Set small = numbered_events("sub", 5);
+    Event::Set large = numbered_events("sub", 50);
+    Event::Set other = numbered_events("other", 50);
+    check_eq(small.is_subset_of(small), true);
+    check_eq(small.is_subset_of(large), true);
+    check_eq(large.is_subset_of(small), false);
+    check_eq(large.is_subset_of(large), true);
+    check_eq(large.is_subset_of(other), false);
+    check_eq(Event::Set().is_subset_of(small), true);
+    check_ne(small, large);
+}
+
+TEST_CASE("sparse and dense event sets")
+{
+    // Create a long run of events, so that we can build sets whose indices are
+    // spread out (which should be stored as sorted arrays) and sets whose
+    // indices are packed together far from 0 (which should be stored as
+    // bitsets that only cover their own range).  We check every step against a
+    // std::set.
+    std::vector<Event> events;
+    for (unsigned int i = 0; i < 5000; i++) {
+        events.push_back(Event("range" + std::to_string(i)));
+    }
+    Event::Set set;
+    std::set<Event> expected;
+    auto check_contents = [&set, &expected]() {
+        check_eq(set.size(), Event::Set::size_type(expected.size()));
+        auto it = set.begin();
+        for (const Event event : expected) {
+            check_eq(*it++, event);
+        }
+        check_eq(it == set.end(), true);
+        Event::Set copy(expected.begin(), expected.end());
+        check_eq(set, copy);
+        check_eq(set.hash(), copy.hash());
+        check_eq(copy.is_subset_of(set), true);
+    };
+
+    // Spread out
+    for (unsigned int i = 0; i < 5000; i += 250) {
+        set.insert(events[i]);
+        expected.insert(events[i]);
+        check_contents();
+    }
+    // Filling in a narrow range makes the set dense enough for a bitset.
+    for (unsigned int i = 2000; i < 3000; i++) {
+        set.insert(events[i]);
+        expected.insert(events[i]);
+    }
+    check_contents();
+    check_eq(set.contains(events[2500]), true);
+    check_eq(set.contains(events[3001]), false);
+    // Removing most of it, and then adding a far-away event, makes the set
+    // sparse again.
+    for (unsigned int i = 2000; i < 2990; i++) {
+        set.erase(events[i]);
+        expected.erase(events[i]);
+    }
+    set.insert(events[4999]);
+    expected.insert(events[4999]);
+    check_contents();
+    for (const Event event : expected) {
+        check_eq(set.erase(event), Event::Set::size_type(1));
+    }
+    expected.clear();
+    check_contents();
+}
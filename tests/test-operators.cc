@@ -8,8 +8,11 @@
 #include <algorithm>
 #include <assert.h>
 #include <initializer_list>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "test-cases.h"
@@ -23,6 +26,8 @@
 
 using hst::Environment;
 using hst::Event;
+using hst::Failures;
+using hst::FailuresDivergences;
 using hst::NormalizedProcess;
 using hst::ParseError;
 using hst::Process;
@@ -161,6 +166,41 @@ check_traces_behavior(const std::string& csp0,
     check_eq(actual.events(), events_from_names(expected));
 }
 
+// Verify that the given CSP₀ process has a particular stable failures behavior.
+void
+check_failures_behavior(
+        const std::string& csp0,
+        std::initializer_list<const std::string> initials,
+        std::initializer_list<std::initializer_list<const std::string>>
+                acceptances)
+{
+    Environment env;
+    const Process* process = require_csp0(&env, csp0);
+    Failures::Behavior actual = Failures::get_process_behavior(*process);
+    check_eq(actual.initials(), events_from_names(initials));
+    check_eq(actual.acceptances().size(), acceptances.size());
+    for (const auto& acceptance : acceptances) {
+        Event::Set expected = events_from_names(acceptance);
+        if (std::find(actual.acceptances().begin(), actual.acceptances().end(),
+                      expected) == actual.acceptances().end()) {
+            fail() << "Missing acceptance " << expected << " for " << csp0
+                   << abort_test();
+        }
+    }
+}
+
+// Verify whether the given CSP₀ process can diverge, both directly and in the
+// failures-divergences model.
+void
+check_divergent(const std::string& csp0, bool expected)
+{
+    Environment env;
+    const Process* process = require_csp0(&env, csp0);
+    check_eq(env.diverges(*process), expected);
+    check_eq(FailuresDivergences::get_process_behavior(*process).divergent(),
+             expected);
+}
+
 // Verify that the given CSP₀ process has a particular set of maximal traces.
 void
 check_maximal_traces(
@@ -206,6 +246,117 @@ check_expansion(const std::string& csp0,
     check_eq(actual, require_csp0_set(&env, expected));
 }
 
+// Verify that a parallel BFS of `csp0` with `threads` threads finds the same
+// processes as a sequential one.
+void
+check_parallel_reachable(const std::string& csp0, unsigned int threads,
+                         bool cache_transitions = false)
+{
+    Environment env;
+    if (cache_transitions) {
+        env.cache_transitions();
+    }
+    const Process* process = require_csp0(&env, csp0);
+    std::vector<const Process*> expected;
+    process->bfs([&expected](const Process& process) {
+        expected.push_back(&process);
+    });
+    std::vector<const Process*> actual;
+    process->parallel_bfs(threads, [&actual](const Process& process) {
+        actual.push_back(&process);
+    });
+    std::sort(expected.begin(), expected.end());
+    std::sort(actual.begin(), actual.end());
+    if (actual != expected) {
+        fail() << "Parallel BFS of " << csp0 << " found " << actual.size()
+               << " processes; expected " << expected.size() << abort_test();
+    }
+}
+
+// Verify that normalizing `csp0` with multiple threads gives the same result as
+// normalizing it with one.
+void
+check_parallel_normalization(const std::string& csp0)
+{
+    Environment env;
+    const Process* process = require_csp0(&env, csp0);
+    const NormalizedProcess* prenormalized = env.prenormalize(process);
+    const NormalizedProcess* expected = env.normalize<Traces>(prenormalized);
+    for (unsigned int threads : {2, 4}) {
+        check_eq(env.normalize<Traces>(prenormalized, threads), expected);
+    }
+}
+
+// Verify that the transition cache reports the same transitions as the
+// operational semantics, for every process reachable from `process`.
+void
+check_cached_transitions(const std::string& csp0)
+{
+    using Transitions = std::set<std::pair<Event, const Process*>>;
+    Environment env;
+    const Process* process = require_csp0(&env, csp0);
+    std::vector<const Process*> reachable;
+    std::vector<Transitions> expected;
+    std::vector<Event::Set> expected_initials;
+    process->bfs([&reachable, &expected,
+                  &expected_initials](const Process& process) {
+        Transitions transitions;
+        process.transitions(
+                [&transitions](Event initial, const Process& after) {
+                    transitions.insert(std::make_pair(initial, &after));
+                });
+        Event::Set initials;
+        process.initials(&initials);
+        reachable.push_back(&process);
+        expected.push_back(std::move(transitions));
+        expected_initials.push_back(std::move(initials));
+    });
+
+    env.cache_transitions();
+    // The first round fills the cache; the second reads from it.
+    for (int round = 0; round < 2; round++) {
+        for (std::size_t i = 0; i < reachable.size(); i++) {
+            Transitions actual;
+            reachable[i]->transitions(
+                    [&actual](Event initial, const Process& after) {
+                        actual.insert(std::make_pair(initial, &after));
+                    });
+            Transitions actual_by_event;
+            for (const auto& transition : expected[i]) {
+                Event initial = transition.first;
+                reachable[i]->transitions(
+                        initial,
+                        [&actual_by_event, initial](const Process& after) {
+                            actual_by_event.insert(
+                                    std::make_pair(initial, &after));
+                        });
+            }
+            if (actual != expected[i] || actual_by_event != expected[i]) {
+                fail() << "Cached transitions differ for " << *reachable[i]
+                       << abort_test();
+            }
+            Event::Set actual_initials;
+            reachable[i]->cached_initials(&actual_initials);
+            check_eq(actual_initials, expected_initials[i]);
+        }
+    }
+}
+
+// Returns the afters of `csp0`, which must be a normalized process, after
+// following `first` and `second`.
+std::pair<const NormalizedProcess*, const NormalizedProcess*>
+normalized_afters(Environment* env, const std::string& csp0,
+                  const std::string& first, const std::string& second)
+{
+    const NormalizedProcess* process =
+            dynamic_cast<const NormalizedProcess*>(require_csp0(env, csp0));
+    if (process == nullptr) {
+        fail() << csp0 << " isn't normalized" << abort_test();
+    }
+    return std::make_pair(process->after(Event(first)),
+                          process->after(Event(second)));
+}
+
 }  // namespace
 
 TEST_CASE_GROUP("process comparisons");
@@ -283,6 +434,20 @@ TEST_CASE("process equality considers cardinality of contents of bags")
     check_ne(p3, p4);
 }
 
+TEST_CASE("hashes of sets and bags don't depend on insertion order")
+{
+    Environment env;
+    auto p1 = require_csp0(&env, "a → STOP");
+    auto p2 = require_csp0(&env, "b → STOP");
+    auto p3 = require_csp0(&env, "c → STOP");
+    check_eq((Process::Set{p1, p2, p3}).hash(),
+             (Process::Set{p3, p1, p2}).hash());
+    check_eq((Process::Bag{p1, p1, p2}).hash(),
+             (Process::Bag{p2, p1, p1}).hash());
+    check_ne((Process::Bag{p1, p1, p2}).hash(),
+             (Process::Bag{p1, p2, p2}).hash());
+}
+
 TEST_CASE_GROUP("external choice");
 
 TEST_CASE("STOP □ STOP")
@@ -346,6 +511,15 @@ TEST_CASE("□ {a → STOP, b → STOP, c → STOP}")
     check_maximal_traces(p, {{"a"}, {"b"}, {"c"}});
 }
 
+TEST_CASE("a → STOP □ (a → STOP ⊓ b → STOP)")
+{
+    // One of the τ-afters of the internal choice is also a sibling in the
+    // external choice, which must not be removed from any of the τ-afters.
+    auto p = "a → STOP □ (a → STOP ⊓ b → STOP)";
+    check_initials(p, {"a", "τ"});
+    check_afters(p, "τ", {"□ {a → STOP}", "a → STOP □ b → STOP"});
+}
+
 TEST_CASE_GROUP("interleaving");
 
 TEST_CASE("STOP ⫴ STOP")
@@ -614,6 +788,18 @@ TEST_CASE("let X=Y □ Z Y=a → X Z=b → X within X")
     check_maximal_traces(p, {{"a"}, {"b"}});
 }
 
+TEST_CASE("let X=a → STOP ⊓ Y Y=b → STOP ⊓ X within X")
+{
+    // X@0 and Y@0 form a τ-cycle; the τ-closure has to stop once it gets back
+    // around to where it started.
+    auto p = "let X=a → STOP ⊓ Y Y=b → STOP ⊓ X within X";
+    check_name(p, "let X=a → STOP ⊓ Y Y=X ⊓ b → STOP within X");
+    check_initials(p, {"τ"});
+    check_afters(p, "τ", {"a → STOP", "Y@0"});
+    check_reachable(p, {"X@0", "Y@0", "a → STOP", "b → STOP", "STOP"});
+    check_tau_closure(p, {"X@0", "Y@0", "a → STOP", "b → STOP"});
+}
+
 TEST_CASE_GROUP("SKIP");
 
 TEST_CASE("SKIP")
@@ -717,6 +903,152 @@ TEST_CASE("(a → b → STOP ⊓ SKIP) ; STOP")
     check_maximal_traces(p, {{"a", "b"}});
 }
 
+TEST_CASE_GROUP("transition cache");
+
+TEST_CASE("cached transitions match the operational semantics")
+{
+    check_cached_transitions("a → STOP □ (a → STOP ⊓ b → STOP)");
+    check_cached_transitions("(a → SKIP ⫴ b → SKIP) ; c → STOP");
+    check_cached_transitions("let X=a → Y Y=b → X within X");
+    check_cached_transitions("⫴ {a → STOP, b → STOP, c → STOP}");
+}
+
+TEST_CASE("cached transitions of normalized processes")
+{
+    // Calculating these processes' transitions fills in the cached
+    // transitions of the processes that they're built from.
+    check_cached_transitions("prenormalize {a → STOP ⊓ (b → STOP □ c → STOP)}");
+    check_cached_transitions("prenormalize {(a → SKIP ⫴ b → SKIP) ; c → STOP}");
+    check_cached_transitions(
+            "normalize[T] {d → (a → STOP ⊓ b → STOP) □ "
+            "e → (a → STOP □ b → STOP)}");
+    check_cached_transitions(
+            "normalize[F] {let X=a → X ⊓ b → STOP within X}");
+}
+
+TEST_CASE_GROUP("τ-closure cache");
+
+TEST_CASE("processes in a τ-cycle share their τ-closure")
+{
+    Environment env;
+    const Process* x =
+            require_csp0(&env, "let X=a → STOP ⊓ Y Y=b → STOP ⊓ X within X");
+    const Process* y = require_csp0(&env, "Y@0");
+    const Process::Set& x_closure = env.tau_closure(*x);
+    const Process::Set& y_closure = env.tau_closure(*y);
+    check_eq(&x_closure, &y_closure);
+    check_eq(x_closure,
+             require_csp0_set(&env, {"X@0", "Y@0", "a → STOP", "b → STOP"}));
+
+    // a → STOP isn't part of the cycle, so it has its own (smaller) closure.
+    const Process* a = require_csp0(&env, "a → STOP");
+    check_eq(env.tau_closure(*a), Process::Set{a});
+}
+
+TEST_CASE("processes in a τ-cycle diverge")
+{
+    check_divergent("let X=a → STOP ⊓ Y Y=b → STOP ⊓ X within X", true);
+    // A τ-transition back to the same process is a cycle, too.
+    check_divergent("let X=X ⊓ a → STOP within X", true);
+    check_divergent("a → STOP", false);
+}
+
+TEST_CASE("processes that can reach a τ-cycle diverge")
+{
+    check_divergent("let P=a → STOP ⊓ X X=X ⊓ b → STOP within P", true);
+    // Only τ-cycles count; a cycle of visible events isn't a divergence.
+    check_divergent("a → STOP ⊓ b → STOP", false);
+    check_divergent("let X=a → X within X", false);
+    check_divergent("let P=a → X X=X ⊓ b → STOP within P", false);
+}
+
+TEST_CASE("long τ-chains")
+{
+    // Deciding divergence mustn't build any closures, so this is quick even
+    // though each process's closure contains everything after it in the
+    // chain.  Once we've done that, we can still ask for closures on demand.
+    const std::size_t length = 2000;
+    std::string csp0 = "let";
+    for (std::size_t i = 0; i < length; ++i) {
+        csp0 += " P" + std::to_string(i) + "=a → STOP ⊓ P" +
+                std::to_string(i + 1);
+    }
+    csp0 += " P" + std::to_string(length) + "=STOP within P0";
+
+    Environment env;
+    const Process* head = require_csp0(&env, csp0);
+    const Process* middle = require_csp0(&env, "P1000@0");
+    check_eq(env.diverges(*head), false);
+    check_eq(env.diverges(*middle), false);
+    check_eq(env.tau_closure(*middle).size(), std::size_t(length - 1000 + 2));
+    check_eq(env.tau_closure(*head).size(), std::size_t(length + 2));
+    check_eq(env.tau_closure(*head).count(middle), std::size_t(1));
+
+    // Closing the chain into a cycle makes every process in it divergent.
+    std::string cycle = csp0;
+    cycle.replace(cycle.rfind("=STOP"), 5, "=P0");
+    Environment cycle_env;
+    check_eq(cycle_env.diverges(*require_csp0(&cycle_env, cycle)), true);
+    check_eq(cycle_env.diverges(*require_csp0(&cycle_env, "P1000@0")), true);
+}
+
+TEST_CASE_GROUP("parallel reachability");
+
+TEST_CASE("parallel BFS finds the same processes as sequential BFS")
+{
+    check_parallel_reachable("a → STOP □ (a → STOP ⊓ b → STOP)", 4);
+    check_parallel_reachable("let X=a → Y Y=b → X within X", 4);
+    // This one is large enough that its frontiers are expanded by several
+    // threads at once.
+    check_parallel_reachable(
+            "⫴ {a0 → b0 → STOP, a1 → b1 → STOP, a2 → b2 → STOP, "
+            "a3 → b3 → STOP, a4 → b4 → STOP, a5 → b5 → STOP, "
+            "a6 → b6 → STOP, a7 → b7 → STOP}",
+            2);
+}
+
+TEST_CASE("parallel BFS with a transition cache")
+{
+    // The cache can't be filled in from several threads at once, so this has
+    // to fall back on a sequential search.
+    check_parallel_reachable(
+            "⫴ {a0 → b0 → STOP, a1 → b1 → STOP, a2 → b2 → STOP, "
+            "a3 → b3 → STOP, a4 → b4 → STOP, a5 → b5 → STOP, "
+            "a6 → b6 → STOP, a7 → b7 → STOP}",
+            4, true);
+}
+
+TEST_CASE("processes registered concurrently are still unique")
+{
+    const std::string csp0 = "(a → SKIP ⫴ b → SKIP) ; (c → STOP ⊓ d → STOP)";
+    const unsigned int thread_count = 8;
+    Environment env;
+    std::vector<std::vector<const Process*>> reachable(thread_count);
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < thread_count; i++) {
+        threads.emplace_back([&env, &csp0, &reachable, i] {
+            ParseError error;
+            const Process* process = load_csp0_string(&env, csp0, &error);
+            process->bfs([&reachable, i](const Process& process) {
+                reachable[i].push_back(&process);
+            });
+            std::sort(reachable[i].begin(), reachable[i].end());
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (unsigned int i = 1; i < thread_count; i++) {
+        if (reachable[i] != reachable[0]) {
+            fail() << "Thread " << i << " found different processes"
+                   << abort_test();
+        }
+    }
+    for (const Process* process : reachable[0]) {
+        check_eq(env.process(process->index()), process);
+    }
+}
+
 TEST_CASE_GROUP("prenormalization");
 
 TEST_CASE("prenormalize {a → STOP}")
@@ -802,6 +1134,20 @@ TEST_CASE("prenormalize {a → SKIP ; b → STOP}")
     check_expansion(p, {"a → SKIP ; b → STOP"});
 }
 
+TEST_CASE("prenormalized processes are identified by their τ-closures")
+{
+    Environment env;
+    const Process* choice = require_csp0(&env, "a → STOP ⊓ b → STOP");
+    const Process* a = require_csp0(&env, "a → STOP");
+    const Process* b = require_csp0(&env, "b → STOP");
+    const NormalizedProcess* p1 = env.prenormalize(choice);
+    const NormalizedProcess* p2 = env.prenormalize(Process::Set{a, b, choice});
+    const NormalizedProcess* p3 = env.prenormalize(Process::Set{a, b});
+    check_eq(p1, p2);
+    check_ne(p1, p3);
+    check_eq(p1->hash(), p2->hash());
+}
+
 TEST_CASE_GROUP("normalization");
 
 TEST_CASE("normalize[T] {a → STOP}")
@@ -865,3 +1211,128 @@ TEST_CASE("normalize[T] {b → a → a → STOP □ c → a → a → STOP} (usi
     check_maximal_traces(p, {{"b", "a", "a"}, {"c", "a", "a"}});
     check_expansion(p, {"root@0"});
 }
+
+TEST_CASE("normalize[T] {b → a → a → STOP □ c → a → STOP} (using let)")
+{
+    // A, B, and D all have the same initials, but A can perform two a's while
+    // B and D can only perform one, so refinement has to split them apart.
+    auto p = "normalize[T] {"
+             "  let "
+             "    root=b → A □ c → D "
+             "    A=□ {a → B} "
+             "    B=□ {a → C} "
+             "    C=□ {} "
+             "    D=□ {a → E} "
+             "    E=□ {} "
+             "  within root"
+             "}";
+    check_initials(p, {"b", "c"});
+    check_afters(p, "b", {"normalize[T] {A@0} within {root@0}"});
+    check_afters(p, "c", {"normalize[T] {B@0,D@0} within {root@0}"});
+    check_reachable(p, {"normalize[T] {root@0}",
+                        "normalize[T] {A@0} within {root@0}",
+                        "normalize[T] {B@0,D@0} within {root@0}",
+                        "normalize[T] {C@0,E@0} within {root@0}"});
+    check_maximal_traces(p, {{"b", "a", "a"}, {"c", "a"}});
+    check_expansion(p, {"root@0"});
+}
+
+TEST_CASE("normalize[F] distinguishes afters with the same traces")
+{
+    // Both afters have the same traces, so the traces model merges them, but
+    // they have different acceptances, so the failures model doesn't.
+    auto traces = "normalize[T] {"
+                  "d → (a → STOP ⊓ b → STOP) □ e → (a → STOP □ b → STOP)}";
+    auto failures = "normalize[F] {"
+                    "d → (a → STOP ⊓ b → STOP) □ e → (a → STOP □ b → STOP)}";
+    check_afters(traces, "d",
+                 {"normalize[T] "
+                  "{a → STOP □ b → STOP, a → STOP ⊓ b → STOP, a → STOP, "
+                  "b → STOP} "
+                  "within {d → (a → STOP ⊓ b → STOP) □ "
+                  "e → (a → STOP □ b → STOP)}"});
+    check_afters(failures, "d",
+                 {"normalize[F] {a → STOP ⊓ b → STOP, a → STOP, b → STOP} "
+                  "within {d → (a → STOP ⊓ b → STOP) □ "
+                  "e → (a → STOP □ b → STOP)}"});
+    check_afters(failures, "e",
+                 {"normalize[F] {a → STOP □ b → STOP} "
+                  "within {d → (a → STOP ⊓ b → STOP) □ "
+                  "e → (a → STOP □ b → STOP)}"});
+    check_failures_behavior(failures, {"d", "e"}, {{"d", "e"}});
+}
+
+TEST_CASE("parallel normalization matches sequential normalization")
+{
+    check_parallel_normalization("a → STOP");
+    check_parallel_normalization("let X=a → Y Y=b → X within X");
+    check_parallel_normalization(
+            "let root=b → A □ c → D A=□ {a → B} B=□ {a → C} C=□ {} "
+            "D=□ {a → E} E=□ {} within root");
+    check_parallel_normalization(
+            "(a → SKIP ⫴ b → SKIP) ; (c → STOP ⊓ a → b → STOP)");
+}
+
+TEST_CASE_GROUP("stable failures");
+
+TEST_CASE("STOP")
+{
+    check_failures_behavior("STOP", {}, {{}});
+}
+
+TEST_CASE("a → STOP □ b → STOP")
+{
+    check_failures_behavior("a → STOP □ b → STOP", {"a", "b"}, {{"a", "b"}});
+}
+
+TEST_CASE("a → STOP ⊓ b → STOP")
+{
+    // The choice itself is unstable, so it doesn't have any acceptances of its
+    // own.
+    check_failures_behavior("a → STOP ⊓ b → STOP", {}, {});
+    // But its τ-closure accepts either event.
+    check_failures_behavior("prenormalize {a → STOP ⊓ b → STOP}", {"a", "b"},
+                            {{"a"}, {"b"}});
+}
+
+TEST_CASE("minimal acceptances")
+{
+    // {a} is a subset of {a,b}, so the larger acceptance is redundant.
+    check_failures_behavior("prenormalize {a → STOP ⊓ (a → STOP □ b → STOP)}",
+                            {"a", "b"}, {{"a"}});
+}
+
+TEST_CASE_GROUP("failures-divergences");
+
+TEST_CASE("divergent behaviors are all equivalent")
+{
+    Environment env;
+    const Process* p = require_csp0(&env, "let X=X ⊓ a → STOP within X");
+    const Process* q = require_csp0(&env, "let Y=Y ⊓ b → STOP within Y");
+    const Process* r = require_csp0(&env, "a → STOP");
+    auto p_behavior = FailuresDivergences::get_process_behavior(*p);
+    auto q_behavior = FailuresDivergences::get_process_behavior(*q);
+    auto r_behavior = FailuresDivergences::get_process_behavior(*r);
+    check_eq(p_behavior, q_behavior);
+    check_eq(p_behavior.hash(), q_behavior.hash());
+    check_ne(p_behavior, r_behavior);
+}
+
+TEST_CASE("normalize[FD] merges divergent processes")
+{
+    // Both afters can diverge, so the failures-divergences model treats them as
+    // equivalent, even though they have different stable acceptances.
+    Environment env;
+    auto fd = normalized_afters(&env,
+                                "normalize[FD] {"
+                                "c → (let X=X ⊓ a → STOP within X) □ "
+                                "d → (let Y=Y ⊓ (a → STOP ⊓ STOP) within Y)}",
+                                "c", "d");
+    check_eq(fd.first, fd.second);
+    auto f = normalized_afters(&env,
+                               "normalize[F] {"
+                               "c → (let X=X ⊓ a → STOP within X) □ "
+                               "d → (let Y=Y ⊓ (a → STOP ⊓ STOP) within Y)}",
+                               "c", "d");
+    check_ne(f.first, f.second);
+}
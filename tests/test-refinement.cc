@@ -5,6 +5,9 @@
  * -----------------------------------------------------------------------------
  */
 
+#include <sys/resource.h>
+#include <cstddef>
+#include <sstream>
 #include <string>
 
 #include "test-cases.h"
@@ -13,16 +16,25 @@
 #include "hst/csp0.h"
 #include "hst/environment.h"
 #include "hst/event.h"
+#include "hst/probabilistic-set.h"
 #include "hst/process.h"
 #include "hst/refinement.h"
 #include "hst/semantic-models.h"
 
 using hst::Environment;
+using hst::AntichainRefinementChecker;
+using hst::BitstateSet;
 using hst::Event;
+using hst::Failures;
+using hst::FailuresDivergences;
+using hst::HashCompactionSet;
 using hst::NormalizedProcess;
 using hst::ParseError;
+using hst::ProbabilisticSet;
 using hst::Process;
 using hst::RefinementChecker;
+using hst::RefinementCounterexample;
+using hst::RefinementSearch;
 using hst::Traces;
 
 namespace {
@@ -38,9 +50,32 @@ require_csp0(Environment* env, const std::string& csp0)
     return parsed;
 }
 
+// Returns whether the antichain checker agrees that `impl` refines `spec` iff
+// `expected` is true.  The antichain checker only supports the traces model, so
+// there's nothing to compare against for any other model.
 template <typename Model>
-void
-check_refinement(const std::string& spec_csp0, const std::string& impl_csp0)
+bool
+antichain_agrees(const Process*, const Process*, bool)
+{
+    return true;
+}
+
+template <>
+bool
+antichain_agrees<Traces>(const Process* spec, const Process* impl,
+                         bool expected)
+{
+    AntichainRefinementChecker checker;
+    return checker.refines(spec, impl) == expected;
+}
+
+// Checks whether `impl` refines `spec`, both against the normalized spec and
+// (lazily) against the prenormalized spec, with the single- and multi-threaded
+// checkers, with depth-first and external searches, and (for traces) with the
+// antichain checker, and verifies that all of the checks agree.
+template <typename Model>
+bool
+refines(const std::string& spec_csp0, const std::string& impl_csp0)
 {
     Environment env;
     const Process* spec = require_csp0(&env, spec_csp0);
@@ -49,7 +84,52 @@ check_refinement(const std::string& spec_csp0, const std::string& impl_csp0)
             env.normalize<Model>(prenormalized_spec);
     const Process* impl = require_csp0(&env, impl_csp0);
     RefinementChecker<Model> checker;
-    if (!checker.refines(normalized_spec, impl)) {
+    bool result = checker.refines(normalized_spec, impl);
+    bool lazy_result = checker.refines(prenormalized_spec, impl);
+    if (result != lazy_result) {
+        fail() << "Lazy refinement check disagrees: " << spec_csp0 << " ⊑"
+               << Model::abbreviation() << " " << impl_csp0 << abort_test();
+    }
+    bool parallel_result = checker.refines(normalized_spec, impl, 4);
+    if (result != parallel_result) {
+        fail() << "Parallel refinement check disagrees: " << spec_csp0 << " ⊑"
+               << Model::abbreviation() << " " << impl_csp0 << abort_test();
+    }
+    bool parallel_lazy_result = checker.refines(prenormalized_spec, impl, 4);
+    if (result != parallel_lazy_result) {
+        fail() << "Parallel lazy refinement check disagrees: " << spec_csp0
+               << " ⊑" << Model::abbreviation() << " " << impl_csp0
+               << abort_test();
+    }
+    RefinementChecker<Model> dfs_checker(RefinementSearch::depth_first);
+    bool dfs_result = dfs_checker.refines(normalized_spec, impl);
+    if (result != dfs_result) {
+        fail() << "Depth-first refinement check disagrees: " << spec_csp0
+               << " ⊑" << Model::abbreviation() << " " << impl_csp0
+               << abort_test();
+    }
+    // Use tiny runs, so that each level is split across several of them.
+    RefinementChecker<Model> external_checker(
+            RefinementSearch::external_breadth_first);
+    external_checker.set_external_storage("", 16);
+    bool external_result = external_checker.refines(normalized_spec, impl);
+    if (result != external_result) {
+        fail() << "External refinement check disagrees: " << spec_csp0 << " ⊑"
+               << Model::abbreviation() << " " << impl_csp0 << abort_test();
+    }
+    if (!antichain_agrees<Model>(spec, impl, result)) {
+        fail() << "Antichain refinement check disagrees: " << spec_csp0
+               << " ⊑" << Model::abbreviation() << " " << impl_csp0
+               << abort_test();
+    }
+    return result;
+}
+
+template <typename Model>
+void
+check_refinement(const std::string& spec_csp0, const std::string& impl_csp0)
+{
+    if (!refines<Model>(spec_csp0, impl_csp0)) {
         fail() << "Expected refinement to hold: " << spec_csp0 << " ⊑"
                << Model::abbreviation() << " " << impl_csp0 << abort_test();
     }
@@ -58,18 +138,113 @@ check_refinement(const std::string& spec_csp0, const std::string& impl_csp0)
 template <typename Model>
 void
 xcheck_refinement(const std::string& spec_csp0, const std::string& impl_csp0)
+{
+    if (refines<Model>(spec_csp0, impl_csp0)) {
+        fail() << "Expected refinement to NOT hold: " << spec_csp0 << " ⊑"
+               << Model::abbreviation() << " " << impl_csp0 << abort_test();
+    }
+}
+
+// Checks whether there's a counterexample to `spec` ⊑ `impl` within
+// `max_depth` steps of the root, using a bounded depth-first search.
+template <typename Model>
+bool
+refines_within(const std::string& spec_csp0, const std::string& impl_csp0,
+               std::size_t max_depth)
 {
     Environment env;
     const Process* spec = require_csp0(&env, spec_csp0);
-    const NormalizedProcess* prenormalized_spec = env.prenormalize(spec);
     const NormalizedProcess* normalized_spec =
-            env.normalize<Model>(prenormalized_spec);
+            env.normalize<Model>(env.prenormalize(spec));
+    const Process* impl = require_csp0(&env, impl_csp0);
+    RefinementChecker<Model> checker(RefinementSearch::depth_first, max_depth);
+    return checker.refines(normalized_spec, impl);
+}
+
+// Checks whether `impl` refines `spec` using a depth-first search that stores
+// its visited pairs in `visited`.
+template <typename Model>
+bool
+refines_probabilistically(const std::string& spec_csp0,
+                          const std::string& impl_csp0,
+                          ProbabilisticSet* visited)
+{
+    Environment env;
+    const Process* spec = require_csp0(&env, spec_csp0);
+    const NormalizedProcess* normalized_spec =
+            env.normalize<Model>(env.prenormalize(spec));
+    const Process* impl = require_csp0(&env, impl_csp0);
+    RefinementChecker<Model> checker(RefinementSearch::depth_first, 0, visited);
+    return checker.refines(normalized_spec, impl);
+}
+
+template <typename T>
+std::string
+to_string(const T& value)
+{
+    std::stringstream out;
+    out << value;
+    return out.str();
+}
+
+// Verifies that `impl` does not refine `spec`, and that the counterexample
+// ends with `impl` performing `event` after `trace`, ending up in
+// `final_impl`.
+template <typename Model>
+void
+check_counterexample(const std::string& spec_csp0,
+                     const std::string& impl_csp0, const std::string& trace,
+                     const std::string& event, const std::string& final_impl)
+{
+    Environment env;
+    const Process* spec = require_csp0(&env, spec_csp0);
+    const NormalizedProcess* normalized_spec =
+            env.normalize<Model>(env.prenormalize(spec));
     const Process* impl = require_csp0(&env, impl_csp0);
     RefinementChecker<Model> checker;
-    if (checker.refines(normalized_spec, impl)) {
+    RefinementCounterexample counterexample;
+    if (checker.refines(normalized_spec, impl, &counterexample)) {
         fail() << "Expected refinement to NOT hold: " << spec_csp0 << " ⊑"
                << Model::abbreviation() << " " << impl_csp0 << abort_test();
     }
+    check_eq(to_string(counterexample.trace), trace);
+    check_eq(to_string(counterexample.event), event);
+    check_eq(to_string(*counterexample.impl), final_impl);
+
+    // The parallel checker might find a different counterexample, but it must
+    // still find one.
+    RefinementCounterexample parallel_counterexample;
+    if (checker.refines(normalized_spec, impl, 4, &parallel_counterexample)) {
+        fail() << "Expected parallel refinement to NOT hold: " << spec_csp0
+               << " ⊑" << Model::abbreviation() << " " << impl_csp0
+               << abort_test();
+    }
+    check_ne(parallel_counterexample.impl,
+             static_cast<const Process*>(nullptr));
+
+    // And so might the depth-first checker.
+    RefinementChecker<Model> dfs_checker(RefinementSearch::depth_first);
+    RefinementCounterexample dfs_counterexample;
+    if (dfs_checker.refines(normalized_spec, impl, &dfs_counterexample)) {
+        fail() << "Expected depth-first refinement to NOT hold: " << spec_csp0
+               << " ⊑" << Model::abbreviation() << " " << impl_csp0
+               << abort_test();
+    }
+    check_ne(dfs_counterexample.impl, static_cast<const Process*>(nullptr));
+
+    // The external checker also searches breadth-first, so its counterexample
+    // should be just as short, but it might not be the same one.
+    RefinementChecker<Model> external_checker(
+            RefinementSearch::external_breadth_first);
+    external_checker.set_external_storage("", 16);
+    RefinementCounterexample external_counterexample;
+    if (external_checker.refines(normalized_spec, impl,
+                                 &external_counterexample)) {
+        fail() << "Expected external refinement to NOT hold: " << spec_csp0
+               << " ⊑" << Model::abbreviation() << " " << impl_csp0
+               << abort_test();
+    }
+    check_eq(external_counterexample.trace.size(), counterexample.trace.size());
 }
 
 }  // namespace
@@ -107,3 +282,303 @@ TEST_CASE("a → STOP ⊓ b → STOP")
     check_refinement<Traces>("a → STOP ⊓ b → STOP", "a → STOP □ b → STOP");
     check_refinement<Traces>("a → STOP ⊓ b → STOP", "a → STOP ⊓ b → STOP");
 }
+
+TEST_CASE("let X=a → Y Y=a → X within X")
+{
+    // X and Y are equivalent, so the normalized spec has a single state while
+    // the prenormalized spec (used by the lazy check) has two.
+    check_refinement<Traces>("let X=a → Y Y=a → X within X",
+                             "let Z=a → Z within Z");
+    check_refinement<Traces>("let X=a → Y Y=a → X within X", "a → a → STOP");
+    xcheck_refinement<Traces>("let X=a → Y Y=a → X within X",
+                              "a → a → b → STOP");
+}
+
+TEST_CASE("large interleavings")
+{
+    // The impl has 6⁴ states, which is more than fit in the initial visited
+    // set and queue, so this exercises resizing both of them.
+    const std::string impl =
+            "a → a → a → a → a → STOP ⫴ b → b → b → b → b → STOP ⫴ "
+            "c → c → c → c → c → STOP ⫴ d → d → d → d → d → STOP";
+    check_refinement<Traces>(
+            "let X=a → X □ b → X □ c → X □ d → X within X", impl);
+    xcheck_refinement<Traces>("let X=a → X □ b → X □ c → X within X", impl);
+}
+
+TEST_CASE("nondeterministic spec")
+{
+    // Spec can choose to follow either `a` branch at each step, so its
+    // determinization tracks every combination of the three states.
+    auto spec = "let S=a → S □ b → S □ a → T T=a → U □ b → U "
+                "U=a → STOP □ b → STOP within S";
+    check_refinement<Traces>(spec, "let I=a → I □ b → I within I");
+    check_refinement<Traces>(spec, "a → b → a → STOP");
+    xcheck_refinement<Traces>(spec, "a → b → c → STOP");
+}
+
+TEST_CASE_GROUP("failures refinement");
+
+TEST_CASE("STOP")
+{
+    check_refinement<Failures>("STOP", "STOP");
+    xcheck_refinement<Failures>("STOP", "a → STOP");
+    // STOP ⊓ a → STOP can refuse everything, just like STOP, but can also
+    // perform an a.
+    xcheck_refinement<Failures>("STOP", "STOP ⊓ a → STOP");
+}
+
+TEST_CASE("a → STOP")
+{
+    // STOP has the right traces but can refuse a.
+    xcheck_refinement<Failures>("a → STOP", "STOP");
+    check_refinement<Failures>("a → STOP", "a → STOP");
+    xcheck_refinement<Failures>("a → STOP", "a → STOP ⊓ STOP");
+}
+
+TEST_CASE("a → STOP □ b → STOP")
+{
+    check_refinement<Failures>("a → STOP □ b → STOP", "a → STOP □ b → STOP");
+    xcheck_refinement<Failures>("a → STOP □ b → STOP", "a → STOP");
+    xcheck_refinement<Failures>("a → STOP □ b → STOP", "a → STOP ⊓ b → STOP");
+}
+
+TEST_CASE("a → STOP ⊓ b → STOP")
+{
+    check_refinement<Failures>("a → STOP ⊓ b → STOP", "a → STOP");
+    check_refinement<Failures>("a → STOP ⊓ b → STOP", "b → STOP");
+    check_refinement<Failures>("a → STOP ⊓ b → STOP", "a → STOP □ b → STOP");
+    check_refinement<Failures>("a → STOP ⊓ b → STOP", "a → STOP ⊓ b → STOP");
+    xcheck_refinement<Failures>("a → STOP ⊓ b → STOP", "STOP");
+}
+
+TEST_CASE("deadlock after a prefix")
+{
+    check_refinement<Failures>("let X=a → X within X",
+                               "let Y=a → a → Y within Y");
+    xcheck_refinement<Failures>("let X=a → X within X", "a → a → STOP");
+    check_refinement<Traces>("let X=a → X within X", "a → a → STOP");
+}
+
+TEST_CASE_GROUP("failures-divergences refinement");
+
+TEST_CASE("divergence-free processes")
+{
+    check_refinement<FailuresDivergences>("STOP", "STOP");
+    check_refinement<FailuresDivergences>("a → STOP ⊓ b → STOP", "a → STOP");
+    xcheck_refinement<FailuresDivergences>("a → STOP □ b → STOP",
+                                           "a → STOP ⊓ b → STOP");
+}
+
+TEST_CASE("divergent Impl")
+{
+    // Impl's stable failures are fine, but it can also diverge.
+    check_refinement<Failures>("a → STOP", "let X=X ⊓ a → STOP within X");
+    xcheck_refinement<FailuresDivergences>("a → STOP",
+                                           "let X=X ⊓ a → STOP within X");
+}
+
+TEST_CASE("divergence after a prefix")
+{
+    check_refinement<Failures>("a → STOP",
+                               "let P=a → X X=X ⊓ STOP within P");
+    xcheck_refinement<FailuresDivergences>("a → STOP",
+                                           "let P=a → X X=X ⊓ STOP within P");
+}
+
+TEST_CASE("divergent Spec")
+{
+    // Once Spec can diverge, Impl can do anything at all.
+    check_refinement<FailuresDivergences>("let X=X ⊓ a → STOP within X",
+                                          "b → STOP");
+    check_refinement<FailuresDivergences>("let P=a → X X=X ⊓ STOP within P",
+                                          "let Q=a → Y Y=Y ⊓ b → Y within Q");
+    xcheck_refinement<FailuresDivergences>("let P=a → X X=X ⊓ STOP within P",
+                                           "b → STOP");
+}
+
+TEST_CASE_GROUP("bounded traces refinement");
+
+TEST_CASE("deep failure")
+{
+    const std::string spec = "let X=a → X within X";
+    const std::string impl = "a → a → a → b → STOP";
+    check_eq(refines_within<Traces>(spec, impl, 2), true);
+    check_eq(refines_within<Traces>(spec, impl, 3), false);
+}
+
+TEST_CASE("revisit at a shallower depth")
+{
+    // We explore the `a` branch first, which reaches P at depth 2, too deep to
+    // find its failure.  The `b` branch reaches P again at depth 1, so we have
+    // to explore it again.
+    const std::string spec = "let X=a → X □ b → X within X";
+    const std::string impl =
+            "let P=a → c → STOP within a → a → P □ b → P";
+    check_eq(refines_within<Traces>(spec, impl, 1), true);
+    check_eq(refines_within<Traces>(spec, impl, 2), false);
+}
+
+TEST_CASE_GROUP("probabilistic traces refinement");
+
+const std::string large_interleaving =
+        "a → a → a → a → a → STOP ⫴ b → b → b → b → b → STOP ⫴ "
+        "c → c → c → c → c → STOP ⫴ d → d → d → d → d → STOP";
+
+TEST_CASE("bitstate")
+{
+    // The impl has 6⁴ states, and a 2²⁰-bit array is big enough that we're
+    // very unlikely to miss any of them.
+    BitstateSet visited(20, 3);
+    check_eq(refines_probabilistically<Traces>(
+                     "let X=a → X □ b → X □ c → X □ d → X within X",
+                     large_interleaving, &visited),
+             true);
+    check_eq(visited.size(), std::size_t(6 * 6 * 6 * 6));
+    check_eq(visited.omission_probability() < 1e-3, true);
+
+    BitstateSet failing(20, 3);
+    check_eq(refines_probabilistically<Traces>(
+                     "let X=a → X □ b → X □ c → X within X",
+                     large_interleaving, &failing),
+             false);
+}
+
+TEST_CASE("tiny bitstate")
+{
+    // A 64-bit array fills up almost immediately, so we should miss most of
+    // the pairs, and know that we're likely to have done so.
+    BitstateSet visited(6, 3);
+    refines_probabilistically<Traces>(
+            "let X=a → X □ b → X □ c → X □ d → X within X", large_interleaving,
+            &visited);
+    check_eq(visited.size() < std::size_t(6 * 6 * 6 * 6), true);
+    check_eq(visited.omission_probability() > 0.5, true);
+}
+
+TEST_CASE("hash compaction")
+{
+    // A 2¹⁶-slot table comfortably holds all 6⁴ states, and with 64-bit
+    // fingerprints we're very unlikely to have confused any of them.
+    HashCompactionSet visited(16);
+    check_eq(refines_probabilistically<Traces>(
+                     "let X=a → X □ b → X □ c → X □ d → X within X",
+                     large_interleaving, &visited),
+             true);
+    check_eq(visited.size(), std::size_t(6 * 6 * 6 * 6));
+    check_eq(visited.omission_probability() < 1e-3, true);
+
+    HashCompactionSet failing(16);
+    check_eq(refines_probabilistically<Traces>(
+                     "let X=a → X □ b → X □ c → X within X",
+                     large_interleaving, &failing),
+             false);
+}
+
+TEST_CASE("narrow hash compaction fingerprints")
+{
+    // 8-bit fingerprints can't distinguish 6⁴ states, so we should report that
+    // we've probably missed some of them.
+    HashCompactionSet visited(16, 8);
+    refines_probabilistically<Traces>(
+            "let X=a → X □ b → X □ c → X □ d → X within X", large_interleaving,
+            &visited);
+    check_eq(visited.omission_probability() > 0.5, true);
+}
+
+TEST_CASE("full hash compaction table")
+{
+    // A 2⁶-slot table fills up long before we've seen every state.  It must
+    // not grow to make room, and we must report that we've missed pairs.
+    HashCompactionSet visited(6);
+    refines_probabilistically<Traces>(
+            "let X=a → X □ b → X □ c → X □ d → X within X", large_interleaving,
+            &visited);
+    check_eq(visited.size(), std::size_t(60));
+    check_eq(visited.omission_probability(), 1.0);
+}
+
+TEST_CASE_GROUP("external traces refinement");
+
+TEST_CASE("deep chain")
+{
+    // Each level of this search only has a single pair, but there are more
+    // levels than we allow open files, so the search can't use a separate file
+    // for each level.
+    std::string impl;
+    for (int i = 0; i < 1100; i++) {
+        impl += "a → ";
+    }
+    Environment env;
+    const Process* spec = require_csp0(&env, "let X=a → X within X");
+    const NormalizedProcess* normalized_spec =
+            env.normalize<Traces>(env.prenormalize(spec));
+    const Process* passing = require_csp0(&env, impl + "STOP");
+    const Process* failing = require_csp0(&env, impl + "b → STOP");
+
+    struct rlimit old_limit;
+    getrlimit(RLIMIT_NOFILE, &old_limit);
+    struct rlimit limit = old_limit;
+    if (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > 256) {
+        limit.rlim_cur = 256;
+    }
+    setrlimit(RLIMIT_NOFILE, &limit);
+    RefinementChecker<Traces> checker(RefinementSearch::external_breadth_first);
+    bool passing_result = checker.refines(normalized_spec, passing);
+    RefinementCounterexample counterexample;
+    bool failing_result =
+            checker.refines(normalized_spec, failing, &counterexample);
+    setrlimit(RLIMIT_NOFILE, &old_limit);
+
+    check_eq(passing_result, true);
+    check_eq(failing_result, false);
+    check_eq(counterexample.trace.size(), std::size_t(1100));
+    check_eq(to_string(counterexample.event), std::string("b"));
+}
+
+TEST_CASE_GROUP("traces counterexamples");
+
+TEST_CASE("root")
+{
+    check_counterexample<Traces>("let X=a → X within X", "c → STOP □ a → STOP",
+                                 "⟨⟩", "c", "c → STOP □ a → STOP");
+}
+
+TEST_CASE("a → b → STOP")
+{
+    check_counterexample<Traces>("a → STOP", "a → b → STOP", "⟨a⟩", "b",
+                                 "b → STOP");
+}
+
+TEST_CASE("τ steps are hidden")
+{
+    check_counterexample<Traces>("a → STOP", "a → (STOP ⊓ b → STOP)", "⟨a⟩",
+                                 "b", "b → STOP");
+}
+
+TEST_CASE("shortest")
+{
+    // Impl can fail after ⟨a,a,a⟩ or after ⟨b⟩; we should find the shorter one.
+    check_counterexample<Traces>(
+            "let X=a → X □ b → STOP within X",
+            "a → a → a → c → STOP □ b → d → STOP", "⟨b⟩", "d", "d → STOP");
+}
+
+TEST_CASE_GROUP("antichain counterexamples");
+
+TEST_CASE("nondeterministic spec")
+{
+    Environment env;
+    const Process* spec = require_csp0(&env, "a → b → STOP ⊓ a → c → STOP");
+    const Process* impl = require_csp0(&env, "a → d → STOP");
+    AntichainRefinementChecker checker;
+    RefinementCounterexample counterexample;
+    if (checker.refines(spec, impl, &counterexample)) {
+        fail() << "Expected antichain refinement to NOT hold" << abort_test();
+    }
+    check_eq(to_string(counterexample.trace), std::string("⟨a⟩"));
+    check_eq(to_string(counterexample.event), std::string("d"));
+    check_eq(to_string(*counterexample.impl), std::string("d → STOP"));
+    check_eq(to_string(*counterexample.spec),
+             std::string("prenormalize {b → STOP, c → STOP}"));
+}